@@ -1,33 +1,514 @@
 #pragma once
 
+#include <atomic>
+#include <chrono>
+#include <cstdint>
 #include <memory>
+#include <new>
+#include <type_traits>
 
 #include "boost/asio/io_context.hpp"
 #include "boost/fiber/algo/algorithm.hpp"
+#include "boost/fiber/operations.hpp"
 #include "boost/fiber/scheduler.hpp"
 #include "boost/assert.hpp"
 
+#include "asio_fiber/wheel.h"
+
 namespace asio_fiber
 {
 
+struct PollPolicy
+{
+    // max handlers run per wake, more than 1 drains ready completions with poll_one
+    size_t batch = 1;
+    // busy poll before the blocking wait, 0 disables spinning
+    std::chrono::microseconds spin{ 0 };
+    // fairness budget, while fibers stay ready the loop still polls the io_context after this
+    // many fiber dispatches and maybe_yield calls, or this long since the last poll. 0 disables either
+    size_t budget = 0;
+    std::chrono::microseconds budget_time{ 0 };
+};
+
+// plain copy of AlgorithmStats, counters only grow, ready, ready_max and fibers are gauges
+struct AlgorithmStatsSnapshot
+{
+    uint64_t suspend_ns = 0;
+    uint64_t spin_ns = 0;
+    uint64_t sleep_ns = 0;
+    uint64_t handlers = 0;
+    uint64_t wakes = 0;
+    uint64_t notifies = 0;
+    uint64_t coalesced_notifies = 0;
+    uint64_t switches = 0;
+    uint64_t budget_polls = 0;
+    uint64_t ready = 0;
+    uint64_t ready_max = 0;
+    uint64_t fibers = 0;
+
+    // what ThreadGroup::pick weighs, runnable now plus alive
+    uint64_t load() const noexcept { return ready + fibers; }
+
+    double handlers_per_wake() const noexcept
+    {
+        return wakes > 0 ? static_cast<double>(handlers) / wakes : 0.0;
+    }
+
+    // combines threads, ready adds up and ready_max keeps the deepest queue
+    AlgorithmStatsSnapshot& operator+=(const AlgorithmStatsSnapshot& other) noexcept
+    {
+        suspend_ns += other.suspend_ns;
+        spin_ns += other.spin_ns;
+        sleep_ns += other.sleep_ns;
+        handlers += other.handlers;
+        wakes += other.wakes;
+        notifies += other.notifies;
+        coalesced_notifies += other.coalesced_notifies;
+        switches += other.switches;
+        budget_polls += other.budget_polls;
+        ready += other.ready;
+        ready_max = (std::max)(ready_max, other.ready_max);
+        fibers += other.fibers;
+        return *this;
+    }
+};
+
+// written by the scheduling thread(s), may be read from any thread
+struct AlgorithmStats
+{
+    // whole time in suspend_until, spinning and sleeping included
+    std::atomic<uint64_t> suspend_ns{ 0 };
+    std::atomic<uint64_t> spin_ns{ 0 };
+    std::atomic<uint64_t> sleep_ns{ 0 };
+    std::atomic<uint64_t> handlers{ 0 };
+    std::atomic<uint64_t> wakes{ 0 };
+    // notify calls, and those folded into a wakeup already pending
+    std::atomic<uint64_t> notifies{ 0 };
+    std::atomic<uint64_t> coalesced_notifies{ 0 };
+    // fibers picked to run
+    std::atomic<uint64_t> switches{ 0 };
+    // polls forced by a spent PollPolicy::budget
+    std::atomic<uint64_t> budget_polls{ 0 };
+    // ready queue depth without the dispatcher and its high-water mark, only Algorithm and
+    // PriorityAlgorithm keep them
+    std::atomic<uint64_t> ready{ 0 };
+    std::atomic<uint64_t> ready_max{ 0 };
+    // fibers launched by ThreadContext::spawn and not finished yet
+    std::atomic<uint64_t> fibers{ 0 };
+
+    static void add(std::atomic<uint64_t>& counter, uint64_t n) noexcept
+    {
+        counter.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    AlgorithmStatsSnapshot snapshot() const noexcept
+    {
+        AlgorithmStatsSnapshot s;
+        s.suspend_ns = suspend_ns.load(std::memory_order_relaxed);
+        s.spin_ns = spin_ns.load(std::memory_order_relaxed);
+        s.sleep_ns = sleep_ns.load(std::memory_order_relaxed);
+        s.handlers = handlers.load(std::memory_order_relaxed);
+        s.wakes = wakes.load(std::memory_order_relaxed);
+        s.notifies = notifies.load(std::memory_order_relaxed);
+        s.coalesced_notifies = coalesced_notifies.load(std::memory_order_relaxed);
+        s.switches = switches.load(std::memory_order_relaxed);
+        s.budget_polls = budget_polls.load(std::memory_order_relaxed);
+        s.ready = ready.load(std::memory_order_relaxed);
+        s.ready_max = ready_max.load(std::memory_order_relaxed);
+        s.fibers = fibers.load(std::memory_order_relaxed);
+        return s;
+    }
+};
+
+namespace detail
+{
+// at most one wakeup operation is queued at a time, so it always fits the same storage
+struct WakeupState
+{
+    std::atomic<bool> pending{ false };
+    std::aligned_storage<128>::type storage;
+
+    void* allocate(size_t size)
+    {
+        return size <= sizeof(storage) ? &storage : ::operator new(size);
+    }
+
+    void deallocate(void* p) noexcept
+    {
+        if (p != &storage)
+        {
+            ::operator delete(p);
+        }
+    }
+};
+
+template<typename T>
+class WakeupAllocator
+{
+public:
+    using value_type = T;
+
+    explicit WakeupAllocator(WakeupState* state) noexcept : _state(state) {}
+
+    template<typename U>
+    WakeupAllocator(const WakeupAllocator<U>& other) noexcept : _state(other._state) {}
+
+    T* allocate(size_t n) { return static_cast<T*>(_state->allocate(sizeof(T) * n)); }
+    void deallocate(T* p, size_t) noexcept { _state->deallocate(p); }
+
+    template<typename U>
+    bool operator==(const WakeupAllocator<U>& other) const noexcept { return _state == other._state; }
+
+    template<typename U>
+    bool operator!=(const WakeupAllocator<U>& other) const noexcept { return _state != other._state; }
+private:
+    template<typename U>
+    friend class WakeupAllocator;
+
+    WakeupState* _state;
+};
+
+// keeps the state alive until the operation memory has been released
+struct WakeupHandler
+{
+    using allocator_type = WakeupAllocator<void>;
+
+    std::shared_ptr<WakeupState> state;
+
+    allocator_type get_allocator() const noexcept { return allocator_type(state.get()); }
+
+    void operator()() const noexcept
+    {
+        state->pending.store(false, std::memory_order_release);
+    }
+};
+}
+
+// waits for asio completions on behalf of a scheduling algorithm
+class IoPoller
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    IoPoller(const std::shared_ptr<boost::asio::io_context>& io_ctx, const PollPolicy& policy, AlgorithmStats* stats)
+        : _io_ctx(io_ctx), _policy(policy), _stats(stats), _wakeup(std::make_shared<detail::WakeupState>()),
+        _last_poll(Clock::now())
+    {
+        current() = this;
+    }
+
+    IoPoller(const IoPoller&) = delete;
+    IoPoller& operator=(const IoPoller&) = delete;
+
+    ~IoPoller()
+    {
+        if (current() == this)
+        {
+            current() = nullptr;
+        }
+    }
+
+    // poller of the algorithm running on this thread, nullptr if none
+    static IoPoller*& current() noexcept
+    {
+        static thread_local IoPoller* s_current = nullptr;
+        return s_current;
+    }
+
+    void suspend_until(Clock::time_point const& abs_time) noexcept
+    {
+        if (_poll_due)
+        {
+            poll_ready();
+            return;
+        }
+
+        auto entered = _stats ? Clock::now() : Clock::time_point{};
+
+        auto deadline = abs_time;
+        if (_wheel && !_wheel->empty())
+        {
+            deadline = (std::min)(deadline, _wheel->next_expiry());
+        }
+
+        size_t n = 0;
+
+        if (_policy.spin.count() > 0)
+        {
+            n = spin_until((std::min)(deadline, Clock::now() + _policy.spin));
+        }
+
+        if (0 == n)
+        {
+            auto start = _stats ? Clock::now() : Clock::time_point{};
+            n = _io_ctx->run_one_until(deadline);
+
+            if (_stats)
+            {
+                AlgorithmStats::add(_stats->sleep_ns, elapsed_ns(start));
+            }
+        }
+
+        while (n > 0 && n < _policy.batch && _io_ctx->poll_one())
+        {
+            ++n;
+        }
+
+        if (_stats)
+        {
+            AlgorithmStats::add(_stats->handlers, n);
+            AlgorithmStats::add(_stats->wakes, 1);
+            AlgorithmStats::add(_stats->suspend_ns, elapsed_ns(entered));
+        }
+
+        reset_budget();
+        refresh();
+    }
+
+    // charges one unit of the budget, true once it is spent and the loop should poll before
+    // running the next fiber, see yield_to_dispatcher
+    bool budget_spent() noexcept
+    {
+        if (_poll_due)
+        {
+            return true;
+        }
+
+        if (_policy.budget > 0 && ++_dispatches >= _policy.budget)
+        {
+            _poll_due = true;
+        }
+        else if (_policy.budget_time.count() > 0 && Clock::now() - _last_poll >= _policy.budget_time)
+        {
+            _poll_due = true;
+        }
+
+        return _poll_due;
+    }
+
+    bool poll_due() const noexcept { return _poll_due; }
+
+    // called from awakened, the scheduler keeps its dispatcher ready while other fibers run
+    void track(boost::fibers::context* fctx) noexcept
+    {
+        if (fctx->is_context(boost::fibers::type::dispatcher_context))
+        {
+            _dispatcher = fctx;
+        }
+    }
+
+    // what pick_next returns once the budget is spent, instead of the next fiber. a fiber
+    // hands over to the dispatcher, unlinked from its ready queue, and the dispatcher gets
+    // nullptr and goes on to suspend_until, which polls without blocking. ready is false
+    // if the dispatcher is neither running nor ready, pick_next then goes on as usual
+    boost::fibers::context* yield_to_dispatcher(bool& ready) noexcept
+    {
+        ready = true;
+        if (boost::fibers::context::active() == _dispatcher)
+        {
+            return nullptr;
+        }
+
+        if (_dispatcher && _dispatcher->ready_is_linked())
+        {
+            _dispatcher->ready_unlink();
+            return _dispatcher;
+        }
+
+        ready = false;
+        return nullptr;
+    }
+
+    void count_switch() noexcept
+    {
+        if (_stats)
+        {
+            AlgorithmStats::add(_stats->switches, 1);
+        }
+    }
+
+    // single writer, the scheduling thread which owns the queue. depth counts every linked
+    // context, a ready dispatcher is left out of the gauge since it is not load to dispatch by
+    void set_ready(uint64_t depth) noexcept
+    {
+        if (_stats)
+        {
+            if (_dispatcher && _dispatcher->ready_is_linked())
+            {
+                --depth;
+            }
+
+            _stats->ready.store(depth, std::memory_order_relaxed);
+            if (depth > _stats->ready_max.load(std::memory_order_relaxed))
+            {
+                _stats->ready_max.store(depth, std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // advance the coarse clock of the timer wheel, once per loop iteration
+    void refresh() noexcept
+    {
+        if (_wheel)
+        {
+            _wheel->update(Clock::now());
+        }
+    }
+
+    void set_wheel(TimerWheel* wheel) noexcept { _wheel = wheel; }
+
+    // notifies before the loop wakes up share one queued wakeup
+    void notify() noexcept
+    {
+        auto coalesced = _wakeup->pending.exchange(true, std::memory_order_acq_rel);
+        if (!coalesced)
+        {
+            _io_ctx->post(detail::WakeupHandler{ _wakeup });
+        }
+
+        if (_stats)
+        {
+            AlgorithmStats::add(_stats->notifies, 1);
+
+            if (coalesced)
+            {
+                AlgorithmStats::add(_stats->coalesced_notifies, 1);
+            }
+        }
+    }
+
+    // the budget starts over without polling, for a thread sharing the io_context of one that
+    // waits in it and runs the completions
+    void skip_poll() noexcept { reset_budget(); }
+
+    const std::shared_ptr<boost::asio::io_context>& io_ctx() const noexcept { return _io_ctx; }
+private:
+    // runs the completions ready now, the fibers they wake queue behind those already ready
+    void poll_ready() noexcept
+    {
+        auto n = _io_ctx->poll();
+
+        if (_stats)
+        {
+            AlgorithmStats::add(_stats->handlers, n);
+            AlgorithmStats::add(_stats->budget_polls, 1);
+        }
+
+        reset_budget();
+        refresh();
+    }
+
+    void reset_budget() noexcept
+    {
+        _poll_due = false;
+        _dispatches = 0;
+        if (_policy.budget_time.count() > 0)
+        {
+            _last_poll = Clock::now();
+        }
+    }
+
+    size_t spin_until(Clock::time_point const& deadline) noexcept
+    {
+        auto start = Clock::now();
+        auto now = start;
+        size_t n = 0;
+
+        while (0 == n && now < deadline && !_io_ctx->stopped())
+        {
+            n = _io_ctx->poll_one();
+            now = Clock::now();
+        }
+
+        if (_stats)
+        {
+            AlgorithmStats::add(_stats->spin_ns, std::chrono::duration_cast<std::chrono::nanoseconds>(now - start).count());
+        }
+
+        return n;
+    }
+
+    static uint64_t elapsed_ns(Clock::time_point start) noexcept
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+    }
+
+    std::shared_ptr<boost::asio::io_context> _io_ctx;
+    PollPolicy _policy;
+    AlgorithmStats* _stats;
+    std::shared_ptr<detail::WakeupState> _wakeup;
+    TimerWheel* _wheel = nullptr;
+    size_t _dispatches = 0;
+    Clock::time_point _last_poll;
+    bool _poll_due = false;
+    boost::fibers::context* _dispatcher = nullptr;
+};
+
+// gives way to ready I/O completions once the PollPolicy::budget of this thread is spent,
+// cheap enough to call on every iteration of a long loop. true if the fiber yielded
+inline bool maybe_yield() noexcept
+{
+    auto poller = IoPoller::current();
+    if (!poller || !poller->budget_spent())
+    {
+        return false;
+    }
+
+    boost::this_fiber::yield();
+    return true;
+}
+
+// fibers never migrate, so yield(timeout) can use the timer wheel of this thread
 class Algorithm : public boost::fibers::algo::algorithm
 {
 public:
-    explicit Algorithm(const std::shared_ptr<boost::asio::io_context>& io_ctx) noexcept : _io_ctx(io_ctx){}
+    explicit Algorithm(const std::shared_ptr<boost::asio::io_context>& io_ctx,
+        const PollPolicy& policy = {}, AlgorithmStats* stats = nullptr)
+        : _poller(io_ctx, policy, stats)
+    {
+        _poller.set_wheel(&_wheel);
+        TimerWheel::current() = &_wheel;
+    }
+
+    ~Algorithm() override
+    {
+        if (TimerWheel::current() == &_wheel)
+        {
+            TimerWheel::current() = nullptr;
+        }
+    }
 
     void awakened(boost::fibers::context* fctx) noexcept override
     {
         BOOST_ASSERT(fctx != nullptr);
         BOOST_ASSERT(!fctx->ready_is_linked());
         fctx->ready_link(_worker_queue);
+        _poller.track(fctx);
+        _poller.set_ready(++_ready);
     }
 
     boost::fibers::context* pick_next() noexcept override
     {
+        // keeps the coarse clock fresh while the loop never gets to suspend
+        if (0 == (++_picks & kRefreshMask))
+        {
+            _poller.refresh();
+        }
+
         if (!_worker_queue.empty())
         {
+            bool ready = false;
+            auto dispatcher = _poller.budget_spent() ? _poller.yield_to_dispatcher(ready) : nullptr;
+            if (ready)
+            {
+                _poller.set_ready(dispatcher ? --_ready : _ready);
+                return dispatcher;
+            }
+
             auto fctx = &(_worker_queue.front());
             _worker_queue.pop_front();
+            _poller.set_ready(--_ready);
+            _poller.count_switch();
             return fctx;
         }
 
@@ -41,16 +522,21 @@ public:
 
     void suspend_until(std::chrono::steady_clock::time_point const& abs_time) noexcept override
     {
-        _io_ctx->run_one_until(abs_time);
+        _poller.suspend_until(abs_time);
     }
 
     void notify() noexcept override
     {
-        _io_ctx->post([] {});
+        _poller.notify();
     }
 private:
-    std::shared_ptr<boost::asio::io_context> _io_ctx;
+    static constexpr uint32_t kRefreshMask = 63;
+
+    IoPoller _poller;
+    TimerWheel _wheel;
     boost::fibers::scheduler::ready_queue_type _worker_queue;
+    uint64_t _ready = 0;
+    uint32_t _picks = 0;
 };
 
 }
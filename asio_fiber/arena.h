@@ -0,0 +1,138 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+
+#include "boost/assert.hpp"
+
+namespace asio_fiber
+{
+
+namespace detail
+{
+// per-thread free lists of handler memory, blocks may be released on any thread
+class HandlerArena
+{
+public:
+    static void* allocate(size_t size)
+    {
+        auto cls = size_class(size);
+        auto arena = local();
+
+        void* block = nullptr;
+        if (arena && cls < kClasses && arena->_heads[cls])
+        {
+            block = arena->_heads[cls];
+            arena->_heads[cls] = *static_cast<void**>(block);
+            --arena->_counts[cls];
+        }
+        else
+        {
+            block = ::operator new(cls < kClasses ? class_size(cls) : size + kHeader);
+        }
+
+        *static_cast<size_t*>(block) = cls;
+        return static_cast<char*>(block) + kHeader;
+    }
+
+    static void deallocate(void* p) noexcept
+    {
+        auto block = static_cast<char*>(p) - kHeader;
+        auto cls = *reinterpret_cast<size_t*>(block);
+        auto arena = local();
+
+        if (arena && cls < kClasses && arena->_counts[cls] < kMaxCached)
+        {
+            *reinterpret_cast<void**>(block) = arena->_heads[cls];
+            arena->_heads[cls] = block;
+            ++arena->_counts[cls];
+            return;
+        }
+
+        ::operator delete(block);
+    }
+private:
+    static constexpr size_t kHeader = alignof(std::max_align_t);
+    static constexpr size_t kMinShift = 6;
+    static constexpr size_t kClasses = 6;
+    static constexpr size_t kMaxCached = 64;
+
+    ~HandlerArena()
+    {
+        for (auto head : _heads)
+        {
+            while (head)
+            {
+                auto next = *static_cast<void**>(head);
+                ::operator delete(head);
+                head = next;
+            }
+        }
+
+        dead() = true;
+    }
+
+    static constexpr size_t class_size(size_t cls) noexcept { return size_t(1) << (kMinShift + cls); }
+
+    static size_t size_class(size_t size) noexcept
+    {
+        size_t cls = 0;
+        while (cls < kClasses && class_size(cls) < size + kHeader)
+        {
+            ++cls;
+        }
+
+        return cls;
+    }
+
+    // nullptr once the arena of this thread has been destroyed at thread exit
+    static HandlerArena* local() noexcept
+    {
+        if (dead())
+        {
+            return nullptr;
+        }
+
+        static thread_local HandlerArena s_arena;
+        return &s_arena;
+    }
+
+    static bool& dead() noexcept
+    {
+        static thread_local bool s_dead = false;
+        return s_dead;
+    }
+
+    void* _heads[kClasses] = {};
+    size_t _counts[kClasses] = {};
+};
+}
+
+// allocator associated with yield completion handlers, recycles operation memory per thread
+template<typename T>
+class YieldAllocator
+{
+public:
+    using value_type = T;
+
+    YieldAllocator() noexcept = default;
+
+    template<typename U>
+    YieldAllocator(const YieldAllocator<U>&) noexcept {}
+
+    T* allocate(size_t n)
+    {
+        BOOST_ASSERT(alignof(T) <= alignof(std::max_align_t));
+        return static_cast<T*>(detail::HandlerArena::allocate(sizeof(T) * n));
+    }
+
+    void deallocate(T* p, size_t) noexcept { detail::HandlerArena::deallocate(p); }
+
+    template<typename U>
+    bool operator==(const YieldAllocator<U>&) const noexcept { return true; }
+
+    template<typename U>
+    bool operator!=(const YieldAllocator<U>&) const noexcept { return false; }
+};
+
+}
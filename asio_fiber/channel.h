@@ -0,0 +1,652 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include "boost/fiber/context.hpp"
+#include "boost/assert.hpp"
+
+#include "asio_fiber/thread.h"
+
+namespace asio_fiber
+{
+
+enum class ChannelStatus
+{
+    SUCCESS,
+    EMPTY,
+    FULL,
+    CLOSED
+};
+
+namespace detail
+{
+// lives on the stack of the waiting fiber, unlinked by whoever wakes it
+struct FiberWaiter
+{
+    boost::fibers::context* fctx = nullptr;
+    FiberWaiter* next = nullptr;
+
+    // the running fiber
+    static FiberWaiter active() noexcept
+    {
+        FiberWaiter waiter;
+        waiter.fctx = boost::fibers::context::active();
+        return waiter;
+    }
+};
+
+// intrusive FIFO, guarded by its owner
+class FiberWaitQueue
+{
+public:
+    bool empty() const noexcept { return nullptr == _head; }
+
+    void push(FiberWaiter& waiter) noexcept
+    {
+        waiter.next = nullptr;
+        if (_tail)
+        {
+            _tail->next = &waiter;
+        }
+        else
+        {
+            _head = &waiter;
+        }
+
+        _tail = &waiter;
+    }
+
+    FiberWaiter* pop() noexcept
+    {
+        auto waiter = _head;
+        if (waiter)
+        {
+            _head = waiter->next;
+            if (!_head)
+            {
+                _tail = nullptr;
+            }
+        }
+
+        return waiter;
+    }
+
+    // false if the waiter has been popped already
+    bool remove(FiberWaiter& waiter) noexcept
+    {
+        FiberWaiter* prev = nullptr;
+        for (auto it = _head; it; prev = it, it = it->next)
+        {
+            if (it == &waiter)
+            {
+                (prev ? prev->next : _head) = it->next;
+                if (_tail == it)
+                {
+                    _tail = prev;
+                }
+
+                return true;
+            }
+        }
+
+        return false;
+    }
+private:
+    FiberWaiter* _head = nullptr;
+    FiberWaiter* _tail = nullptr;
+};
+
+// resumes a suspended fiber from any thread. schedule goes through the remote ready queue of
+// the scheduler the fiber sleeps on, which under WORK_STEALING or SHARED need not be the thread
+// it waited from, and that scheduler only runs the fiber once it has switched out
+inline void wake_fiber(boost::fibers::context* fctx) noexcept
+{
+    boost::fibers::context::active()->schedule(fctx);
+}
+
+template<typename T>
+using ChannelStorage = typename std::aligned_storage<sizeof(T), alignof(T)>::type;
+}
+
+// bounded channel between fibers of one thread, no atomics nor locks.
+// push blocks while full, pop blocks while empty, both return CLOSED once close was called
+template<typename T>
+class LocalChannel
+{
+public:
+    explicit LocalChannel(size_t capacity) : _slots(new detail::ChannelStorage<T>[capacity]), _capacity(capacity)
+    {
+        BOOST_ASSERT(capacity > 0);
+    }
+
+    ~LocalChannel()
+    {
+        close();
+
+        while (_size > 0)
+        {
+            take();
+        }
+    }
+
+    size_t capacity() const noexcept { return _capacity; }
+    size_t size() const noexcept { return _size; }
+    bool is_closed() const noexcept { return _closed; }
+
+    void close() noexcept
+    {
+        _closed = true;
+        wake_all(_senders);
+        wake_all(_receivers);
+    }
+
+    ChannelStatus try_push(T value)
+    {
+        if (_closed)
+        {
+            return ChannelStatus::CLOSED;
+        }
+
+        if (_size == _capacity)
+        {
+            return ChannelStatus::FULL;
+        }
+
+        put(std::move(value));
+        wake_one(_receivers);
+        return ChannelStatus::SUCCESS;
+    }
+
+    ChannelStatus push(T value)
+    {
+        while (!_closed && _size == _capacity)
+        {
+            wait(_senders);
+        }
+
+        return try_push(std::move(value));
+    }
+
+    ChannelStatus try_pop(T& value)
+    {
+        if (0 == _size)
+        {
+            return _closed ? ChannelStatus::CLOSED : ChannelStatus::EMPTY;
+        }
+
+        value = take();
+        wake_one(_senders);
+        return ChannelStatus::SUCCESS;
+    }
+
+    ChannelStatus pop(T& value)
+    {
+        while (!_closed && 0 == _size)
+        {
+            wait(_receivers);
+        }
+
+        return try_pop(value);
+    }
+
+    // copies [first, last) waiting for room as needed, pass move iterators to move instead.
+    // returns where it stopped if closed meanwhile
+    template<typename InputIt>
+    InputIt push_batch(InputIt first, InputIt last)
+    {
+        while (first != last)
+        {
+            while (!_closed && _size == _capacity)
+            {
+                wait(_senders);
+            }
+
+            if (_closed)
+            {
+                break;
+            }
+
+            size_t n = 0;
+            for (; first != last && _size < _capacity; ++first, ++n)
+            {
+                put(*first);
+            }
+
+            wake_n(_receivers, n);
+        }
+
+        return first;
+    }
+
+    // waits for at least one value and takes up to max, 0 once closed and drained
+    template<typename OutputIt>
+    size_t pop_batch(OutputIt out, size_t max)
+    {
+        while (!_closed && 0 == _size)
+        {
+            wait(_receivers);
+        }
+
+        size_t n = 0;
+        for (; n < max && _size > 0; ++n)
+        {
+            *out++ = take();
+        }
+
+        wake_n(_senders, n);
+        return n;
+    }
+private:
+    T* slot(size_t index) noexcept
+    {
+        return reinterpret_cast<T*>(&_slots[index]);
+    }
+
+    template<typename U>
+    void put(U&& value)
+    {
+        auto index = _head + _size;
+        new (slot(index < _capacity ? index : index - _capacity)) T(std::forward<U>(value));
+        ++_size;
+    }
+
+    T take()
+    {
+        auto p = slot(_head);
+        T value(std::move(*p));
+        p->~T();
+
+        _head = _head + 1 == _capacity ? 0 : _head + 1;
+        --_size;
+        return value;
+    }
+
+    static void wait(detail::FiberWaitQueue& queue)
+    {
+        auto waiter = detail::FiberWaiter::active();
+        queue.push(waiter);
+        waiter.fctx->suspend();
+    }
+
+    static void wake_one(detail::FiberWaitQueue& queue) noexcept
+    {
+        auto waiter = queue.pop();
+        if (waiter)
+        {
+            boost::fibers::context::active()->schedule(waiter->fctx);
+        }
+    }
+
+    static void wake_n(detail::FiberWaitQueue& queue, size_t n) noexcept
+    {
+        for (size_t i = 0; i < n && !queue.empty(); ++i)
+        {
+            wake_one(queue);
+        }
+    }
+
+    static void wake_all(detail::FiberWaitQueue& queue) noexcept
+    {
+        while (!queue.empty())
+        {
+            wake_one(queue);
+        }
+    }
+
+    std::unique_ptr<detail::ChannelStorage<T>[]> _slots;
+    size_t _capacity;
+    size_t _head = 0;
+    size_t _size = 0;
+    bool _closed = false;
+    detail::FiberWaitQueue _senders;
+    detail::FiberWaitQueue _receivers;
+};
+
+// bounded channel from fibers of any threads to fibers of one receiving thread.
+// the ring is lock-free, a sleeping receiver is woken at most once per batch, wherever
+// it sleeps by then. senders only lock when the ring is full.
+// try_push also works from threads without a ThreadContext.
+// T needs no default constructor, values are moved straight out of the ring
+template<typename T>
+class MpscChannel
+{
+public:
+    // capacity is rounded up to a power of 2
+    explicit MpscChannel(size_t capacity)
+    {
+        size_t n = 2;
+        while (n < capacity)
+        {
+            n <<= 1;
+        }
+
+        _cells.reset(new Cell[n]);
+        _mask = n - 1;
+
+        for (size_t i = 0; i < n; ++i)
+        {
+            _cells[i].seq.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    // destroys what is left in place
+    ~MpscChannel()
+    {
+        while (ChannelStatus::SUCCESS == dequeue([](T&&) {})) {}
+    }
+
+    size_t capacity() const noexcept { return _mask + 1; }
+    bool is_closed() const noexcept { return _closed.load(std::memory_order_acquire); }
+
+    // values pushed concurrently with close may still be received, or be dropped
+    void close()
+    {
+        _closed.store(true, std::memory_order_seq_cst);
+        wake_receiver();
+
+        std::lock_guard<std::mutex> lock(_mutex);
+        while (!_senders.empty())
+        {
+            _blocked.fetch_sub(1, std::memory_order_relaxed);
+            auto waiter = _senders.pop();
+            detail::wake_fiber(waiter->fctx);
+        }
+    }
+
+    ChannelStatus try_push(T value)
+    {
+        auto status = enqueue(std::move(value));
+        if (ChannelStatus::SUCCESS == status)
+        {
+            wake_receiver();
+        }
+
+        return status;
+    }
+
+    // suspends the calling fiber while the ring is full
+    ChannelStatus push(T value)
+    {
+        while (true)
+        {
+            auto status = enqueue(std::move(value));
+            if (ChannelStatus::FULL != status)
+            {
+                if (ChannelStatus::SUCCESS == status)
+                {
+                    wake_receiver();
+                }
+
+                return status;
+            }
+
+            wait_for_room();
+        }
+    }
+
+    // as LocalChannel::push_batch, with one receiver wake per run of values that fit
+    template<typename InputIt>
+    InputIt push_batch(InputIt first, InputIt last)
+    {
+        while (first != last)
+        {
+            size_t n = 0;
+            auto status = ChannelStatus::SUCCESS;
+            for (; first != last; ++first, ++n)
+            {
+                status = enqueue(*first);
+                if (ChannelStatus::SUCCESS != status)
+                {
+                    break;
+                }
+            }
+
+            if (n > 0)
+            {
+                wake_receiver();
+            }
+
+            if (ChannelStatus::CLOSED == status)
+            {
+                break;
+            }
+
+            if (ChannelStatus::FULL == status)
+            {
+                wait_for_room();
+            }
+        }
+
+        return first;
+    }
+
+    // receiving thread only
+    ChannelStatus try_pop(T& value)
+    {
+        auto status = dequeue([&value](T&& x) { value = std::move(x); });
+        if (ChannelStatus::SUCCESS == status)
+        {
+            wake_senders(1);
+        }
+
+        return status;
+    }
+
+    // receiving thread only, one fiber at a time
+    ChannelStatus pop(T& value)
+    {
+        while (true)
+        {
+            auto status = try_pop(value);
+            if (ChannelStatus::EMPTY != status)
+            {
+                return status;
+            }
+
+            wait_for_value();
+        }
+    }
+
+    // receiving thread only, waits for at least one value and takes up to max, 0 once closed and drained
+    template<typename OutputIt>
+    size_t pop_batch(OutputIt out, size_t max)
+    {
+        while (true)
+        {
+            size_t n = 0;
+            auto take = [&out](T&& x) { *out++ = std::move(x); };
+            while (n < max && ChannelStatus::SUCCESS == dequeue(take))
+            {
+                ++n;
+            }
+
+            if (n > 0)
+            {
+                wake_senders(n);
+                return n;
+            }
+
+            if (is_closed())
+            {
+                return 0;
+            }
+
+            wait_for_value();
+        }
+    }
+private:
+    struct Cell
+    {
+        std::atomic<size_t> seq;
+        detail::ChannelStorage<T> storage;
+    };
+
+    // value is consumed only on SUCCESS
+    template<typename U>
+    ChannelStatus enqueue(U&& value)
+    {
+        if (_closed.load(std::memory_order_acquire))
+        {
+            return ChannelStatus::CLOSED;
+        }
+
+        auto pos = _tail.load(std::memory_order_relaxed);
+        Cell* cell;
+        while (true)
+        {
+            cell = &_cells[pos & _mask];
+            auto seq = cell->seq.load(std::memory_order_acquire);
+            auto diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+
+            if (0 == diff)
+            {
+                if (_tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    break;
+                }
+            }
+            else if (diff < 0)
+            {
+                return ChannelStatus::FULL;
+            }
+            else
+            {
+                pos = _tail.load(std::memory_order_relaxed);
+            }
+        }
+
+        new (&cell->storage) T(std::forward<U>(value));
+        cell->seq.store(pos + 1, std::memory_order_release);
+        return ChannelStatus::SUCCESS;
+    }
+
+    // hands the head value to f as an rvalue, then destroys it in its cell
+    template<typename F>
+    ChannelStatus dequeue(F&& f)
+    {
+        auto cell = &_cells[_head & _mask];
+        if (cell->seq.load(std::memory_order_acquire) != _head + 1)
+        {
+            return is_closed() ? ChannelStatus::CLOSED : ChannelStatus::EMPTY;
+        }
+
+        auto p = reinterpret_cast<T*>(&cell->storage);
+        f(std::move(*p));
+        p->~T();
+
+        cell->seq.store(_head + _mask + 1, std::memory_order_release);
+        ++_head;
+        return ChannelStatus::SUCCESS;
+    }
+
+    bool readable() const noexcept
+    {
+        return _cells[_head & _mask].seq.load(std::memory_order_acquire) == _head + 1 || is_closed();
+    }
+
+    void wait_for_value()
+    {
+        BOOST_ASSERT(!_receiver.fctx);
+        _receiver = detail::FiberWaiter::active();
+
+        // pairs with the fence in wake_receiver, either we see the value or the sender sees us asleep.
+        // release publishes _receiver to the sender which takes the wake
+        _sleeping.store(true, std::memory_order_release);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        // a sender which already took the wake will resume us, so suspend anyway then
+        if (!readable() || !_sleeping.exchange(false, std::memory_order_acq_rel))
+        {
+            _receiver.fctx->suspend();
+        }
+
+        _receiver.fctx = nullptr;
+    }
+
+    void wake_receiver()
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        if (_sleeping.load(std::memory_order_relaxed) && _sleeping.exchange(false, std::memory_order_acq_rel))
+        {
+            detail::wake_fiber(_receiver.fctx);
+        }
+    }
+
+    void wait_for_room()
+    {
+        auto waiter = detail::FiberWaiter::active();
+
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _senders.push(waiter);
+            _blocked.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        // pairs with the fence in wake_senders, either we see the room or the receiver sees us blocked
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        if (has_room() || is_closed())
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (_senders.remove(waiter))
+            {
+                _blocked.fetch_sub(1, std::memory_order_relaxed);
+                return;
+            }
+        }
+
+        waiter.fctx->suspend();
+    }
+
+    bool has_room() const noexcept
+    {
+        auto pos = _tail.load(std::memory_order_relaxed);
+        return _cells[pos & _mask].seq.load(std::memory_order_acquire) == pos;
+    }
+
+    void wake_senders(size_t n)
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        if (0 == _blocked.load(std::memory_order_relaxed))
+        {
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock(_mutex);
+        for (size_t i = 0; i < n && !_senders.empty(); ++i)
+        {
+            _blocked.fetch_sub(1, std::memory_order_relaxed);
+            auto waiter = _senders.pop();
+            detail::wake_fiber(waiter->fctx);
+        }
+    }
+
+    static constexpr size_t kCacheLine = 64;
+
+    std::unique_ptr<Cell[]> _cells;
+    size_t _mask;
+    // padded apart, senders hammer _tail while the receiver owns _head
+    char _pad0[kCacheLine];
+    std::atomic<size_t> _tail{ 0 };
+    char _pad1[kCacheLine];
+    size_t _head = 0;
+    detail::FiberWaiter _receiver;
+    std::atomic<bool> _sleeping{ false };
+    std::atomic<bool> _closed{ false };
+    char _pad2[kCacheLine];
+
+    // slow path of senders finding the ring full
+    std::atomic<size_t> _blocked{ 0 };
+    std::mutex _mutex;
+    detail::FiberWaitQueue _senders;
+};
+
+}
@@ -0,0 +1,146 @@
+#pragma once
+
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "boost/asio/buffer.hpp"
+#include "boost/asio/write.hpp"
+#include "boost/fiber/context.hpp"
+#include "boost/fiber/operations.hpp"
+#include "boost/system/result.hpp"
+#include "boost/assert.hpp"
+
+#include "asio_fiber/yield.h"
+
+namespace asio_fiber
+{
+
+// lets many fibers write one stream concurrently. buffers queued during a loop turn
+// go out in a single gather write, and each writer resumes once its own bytes are written.
+// Stream may be a reference, e.g. CoalescedStream<tcp::socket&>.
+// single thread: every writer must be a fiber of the thread running the stream, the queue
+// takes no lock. under WORK_STEALING or SHARED pin the writers, see pin_this_fiber.
+// write is the whole API on purpose, it is no AsyncWriteStream: an async_write_some would
+// complete on a partial write of the gather, so one writer could return with the bytes of
+// another still queued. reads and asio compositions go through next_layer()
+template<typename Stream>
+class CoalescedStream
+{
+public:
+    using next_layer_type = typename std::remove_reference<Stream>::type;
+    using executor_type = typename next_layer_type::executor_type;
+
+    template<typename ... Args>
+    explicit CoalescedStream(Args&& ... args) : _next_layer(std::forward<Args>(args)...) {}
+
+    next_layer_type& next_layer() noexcept { return _next_layer; }
+    const next_layer_type& next_layer() const noexcept { return _next_layer; }
+    executor_type get_executor() noexcept { return _next_layer.get_executor(); }
+
+    // blocks the calling fiber until all of buffers are written, or the shared write failed
+    template<typename ConstBufferSequence>
+    boost::system::result<size_t> write(const ConstBufferSequence& buffers)
+    {
+        Writer writer{ boost::fibers::context::active() };
+        for (auto it = boost::asio::buffer_sequence_begin(buffers); it != boost::asio::buffer_sequence_end(buffers); ++it)
+        {
+            boost::asio::const_buffer buffer(*it);
+            _queued.push_back(buffer);
+            writer.size += buffer.size();
+        }
+
+        _writers.push_back(&writer);
+
+        if (!_flushing)
+        {
+            _flushing = true;
+            writer.flusher = true;
+        }
+
+        while (!writer.done)
+        {
+            if (writer.flusher)
+            {
+                writer.flusher = false;
+                flush();
+                continue;
+            }
+
+            writer.waiting = true;
+            writer.fctx->suspend();
+            writer.waiting = false;
+        }
+
+        return std::move(writer.result);
+    }
+private:
+    struct Writer
+    {
+        boost::fibers::context* fctx;
+        size_t size = 0;
+        bool flusher = false;
+        bool waiting = false;
+        bool done = false;
+        boost::system::result<size_t> result{ boost::system::error_code() };
+    };
+
+    void flush()
+    {
+        // every fiber ready in this loop turn gets to queue its buffers first
+        boost::this_fiber::yield();
+
+        _gather.clear();
+        _gather.swap(_queued);
+        _batch.clear();
+        _batch.swap(_writers);
+
+        auto written = boost::asio::async_write(_next_layer, _gather, yield());
+
+        auto fctx = boost::fibers::context::active();
+        for (auto writer : _batch)
+        {
+            if (written)
+            {
+                writer->result = writer->size;
+            }
+            else
+            {
+                writer->result = written.error();
+            }
+
+            writer->done = true;
+            wake(fctx, *writer);
+        }
+
+        // writers queued meanwhile are flushed by the first of them
+        if (_writers.empty())
+        {
+            _flushing = false;
+        }
+        else
+        {
+            _writers.front()->flusher = true;
+            wake(fctx, *_writers.front());
+        }
+    }
+
+    static void wake(boost::fibers::context* fctx, Writer& writer) noexcept
+    {
+        if (writer.waiting)
+        {
+            writer.waiting = false;
+            fctx->schedule(writer.fctx);
+        }
+    }
+
+    Stream _next_layer;
+    bool _flushing = false;
+    // swapped per flush, so their capacity is reused
+    std::vector<boost::asio::const_buffer> _queued;
+    std::vector<boost::asio::const_buffer> _gather;
+    std::vector<Writer*> _writers;
+    std::vector<Writer*> _batch;
+};
+
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <utility>
+
+#include "asio_fiber/scope_frame.h"
+
+namespace asio_fiber
+{
+
+// bounds every yield() of the running fiber while in scope, scopes nest to the tightest deadline.
+// fibers spawned by ThreadContext::spawn start inside the deadline of their parent
+class DeadlineScope : private detail::ScopeFrame
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    template<typename Rep, typename Period>
+    explicit DeadlineScope(std::chrono::duration<Rep, Period> timeout)
+        : DeadlineScope(Clock::now() + std::chrono::duration_cast<Clock::duration>(timeout)) {}
+
+    explicit DeadlineScope(Clock::time_point deadline)
+    {
+        _deadline = (std::min)(deadline, _deadline);
+    }
+
+    Clock::time_point deadline() const noexcept { return _deadline; }
+
+    // deadline of the innermost scope of the running fiber, max() if there is none
+    static Clock::time_point current()
+    {
+        auto frame = top();
+        return frame ? frame->frame_deadline() : (Clock::time_point::max)();
+    }
+
+    static bool expired()
+    {
+        return current() <= Clock::now();
+    }
+
+    // time left in the innermost scope, zero once expired
+    static Clock::duration remaining()
+    {
+        auto deadline = current();
+        if (deadline == (Clock::time_point::max)())
+        {
+            return (Clock::duration::max)();
+        }
+
+        return (std::max)(deadline - Clock::now(), Clock::duration::zero());
+    }
+};
+
+namespace detail
+{
+// runs f of a spawned fiber inside the deadline captured from its parent
+template<typename F>
+class DeadlineCall
+{
+public:
+    template<typename T>
+    DeadlineCall(T&& f, DeadlineScope::Clock::time_point deadline) : _f(std::forward<T>(f)), _deadline(deadline) {}
+
+    template<typename ... Args>
+    void operator()(Args&& ... args)
+    {
+        if (_deadline == (DeadlineScope::Clock::time_point::max)())
+        {
+            _f(std::forward<Args>(args)...);
+            return;
+        }
+
+        DeadlineScope scope(_deadline);
+        _f(std::forward<Args>(args)...);
+    }
+private:
+    F _f;
+    DeadlineScope::Clock::time_point _deadline;
+};
+}
+
+}
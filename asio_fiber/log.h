@@ -0,0 +1,562 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "boost/asio/ip/basic_endpoint.hpp"
+#include "boost/system/error_code.hpp"
+#include "boost/utility/string_view.hpp"
+#include "boost/assert.hpp"
+
+// records below this level are compiled out, 0=TRACE 1=DEBUG 2=INFO 3=WARN 4=ERR 5=NONE
+#ifndef ASIO_FIBER_LOG_LEVEL
+    #define ASIO_FIBER_LOG_LEVEL 2
+#endif
+
+// ASIO_FIBER_LOG(INFO, "accept ", endpoint, ",n=", n), arguments are not evaluated when the level is compiled out
+#define ASIO_FIBER_LOG(LEVEL, ...) \
+    do \
+    { \
+        if (::asio_fiber::LogLevel::LEVEL >= ::asio_fiber::kLogLevel) \
+        { \
+            ::asio_fiber::Logger::log(::asio_fiber::LogLevel::LEVEL, __VA_ARGS__); \
+        } \
+    } while (0)
+
+namespace asio_fiber
+{
+
+enum class LogLevel : uint8_t
+{
+    TRACE,
+    DEBUG,
+    INFO,
+    WARN,
+    ERR,
+    NONE
+};
+
+constexpr LogLevel kLogLevel = static_cast<LogLevel>(ASIO_FIBER_LOG_LEVEL);
+
+// specialize as std::true_type for a trivially copyable type whose operator<< reads nothing
+// behind a pointer, it is then copied as bytes and formatted by the logging thread.
+// arithmetic and enum types always are, other types are formatted on the calling thread
+template<typename T>
+struct LogAsBytes : std::false_type {};
+
+namespace detail
+{
+template<typename T>
+using IsLogString = std::is_convertible<const T&, boost::string_view>;
+
+template<typename T>
+using IsLogPod = std::integral_constant<bool, !IsLogString<T>::value && std::is_trivially_copyable<T>::value
+    && (std::is_arithmetic<T>::value || std::is_enum<T>::value || LogAsBytes<T>::value)>;
+
+// strings are copied, so the record never points into memory of the caller
+struct LogStringCodec
+{
+    static size_t size(boost::string_view s) noexcept { return sizeof(uint32_t) + s.size(); }
+
+    static char* encode(char* p, boost::string_view s) noexcept
+    {
+        auto n = static_cast<uint32_t>(s.size());
+        std::memcpy(p, &n, sizeof(n));
+        std::memcpy(p + sizeof(n), s.data(), n);
+        return p + sizeof(n) + n;
+    }
+
+    static const char* decode(std::ostream& os, const char* p)
+    {
+        uint32_t n;
+        std::memcpy(&n, p, sizeof(n));
+        os.write(p + sizeof(n), n);
+        return p + sizeof(n) + n;
+    }
+};
+
+// numbers, enums and LogAsBytes types are copied as bytes and formatted by the logging thread
+template<typename T>
+struct LogPodCodec
+{
+    static size_t size(const T&) noexcept { return sizeof(T); }
+
+    static char* encode(char* p, const T& v) noexcept
+    {
+        std::memcpy(p, &v, sizeof(T));
+        return p + sizeof(T);
+    }
+
+    static const char* decode(std::ostream& os, const char* p)
+    {
+        typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+        std::memcpy(&storage, p, sizeof(T));
+        os << *reinterpret_cast<const T*>(&storage);
+        return p + sizeof(T);
+    }
+};
+
+// endpoints keep their sockaddr bytes and are formatted by the logging thread
+template<typename Protocol>
+struct LogEndpointCodec
+{
+    using Endpoint = boost::asio::ip::basic_endpoint<Protocol>;
+
+    static size_t size(const Endpoint& ep) noexcept { return sizeof(uint32_t) + ep.size(); }
+
+    static char* encode(char* p, const Endpoint& ep) noexcept
+    {
+        auto n = static_cast<uint32_t>(ep.size());
+        std::memcpy(p, &n, sizeof(n));
+        std::memcpy(p + sizeof(n), ep.data(), n);
+        return p + sizeof(n) + n;
+    }
+
+    static const char* decode(std::ostream& os, const char* p)
+    {
+        uint32_t n;
+        std::memcpy(&n, p, sizeof(n));
+
+        Endpoint ep;
+        std::memcpy(ep.data(), p + sizeof(n), n);
+        ep.resize(n);
+        os << ep;
+        return p + sizeof(n) + n;
+    }
+};
+
+// the value and the category, which lives as long as the process, printed as operator<< does
+struct LogErrorCodec
+{
+    struct Raw
+    {
+        int value;
+        const boost::system::error_category* category;
+    };
+
+    static size_t size(const boost::system::error_code&) noexcept { return sizeof(Raw); }
+
+    static char* encode(char* p, const boost::system::error_code& ec) noexcept
+    {
+        Raw raw{ ec.value(), &ec.category() };
+        std::memcpy(p, &raw, sizeof(raw));
+        return p + sizeof(raw);
+    }
+
+    static const char* decode(std::ostream& os, const char* p)
+    {
+        Raw raw;
+        std::memcpy(&raw, p, sizeof(raw));
+        os << raw.category->name() << ':' << raw.value;
+        return p + sizeof(raw);
+    }
+};
+
+template<typename T, typename = void>
+struct LogArg
+{
+    // anything else is formatted on the calling thread
+    using Codec = LogStringCodec;
+
+    static std::string prepare(const T& v)
+    {
+        std::ostringstream os;
+        os << v;
+        return os.str();
+    }
+};
+
+template<typename T>
+struct LogArg<T, typename std::enable_if<IsLogString<T>::value>::type>
+{
+    using Codec = LogStringCodec;
+
+    static boost::string_view prepare(const T& v) noexcept { return v; }
+};
+
+template<typename T>
+struct LogArg<T, typename std::enable_if<IsLogPod<T>::value>::type>
+{
+    using Codec = LogPodCodec<T>;
+
+    static const T& prepare(const T& v) noexcept { return v; }
+};
+
+template<typename Protocol>
+struct LogArg<boost::asio::ip::basic_endpoint<Protocol>>
+{
+    using Codec = LogEndpointCodec<Protocol>;
+
+    static const boost::asio::ip::basic_endpoint<Protocol>& prepare(const boost::asio::ip::basic_endpoint<Protocol>& v) noexcept
+    {
+        return v;
+    }
+};
+
+template<>
+struct LogArg<boost::system::error_code>
+{
+    using Codec = LogErrorCodec;
+
+    static const boost::system::error_code& prepare(const boost::system::error_code& v) noexcept { return v; }
+};
+
+using LogFormat = void (*)(std::ostream& os, const char* payload);
+
+struct LogRecord
+{
+    // total bytes including this header, 0 marks the unused end of the ring
+    uint32_t size;
+    LogLevel level;
+    int64_t time_us;
+    LogFormat format;
+};
+
+// bytes of records from one producer thread to the logging thread, never blocks the producer
+class LogRing
+{
+public:
+    LogRing(size_t capacity, uint32_t id) : _buffer(capacity), _mask(capacity - 1), _id(id)
+    {
+        BOOST_ASSERT(capacity >= 64 && 0 == (capacity & _mask));
+    }
+
+    uint32_t id() const noexcept { return _id; }
+
+    // nullptr if the logging thread lags too far behind, the record is dropped then
+    char* reserve(size_t size) noexcept
+    {
+        auto tail = _tail.load(std::memory_order_relaxed);
+        auto head = _head.load(std::memory_order_acquire);
+        auto offset = tail & _mask;
+        auto contiguous = _buffer.size() - offset;
+
+        _skip = size > contiguous ? contiguous : 0;
+        if (tail + _skip + size - head > _buffer.size())
+        {
+            _dropped.fetch_add(1, std::memory_order_relaxed);
+            return nullptr;
+        }
+
+        if (_skip > 0)
+        {
+            uint32_t end = 0;
+            std::memcpy(&_buffer[offset], &end, sizeof(end));
+            offset = 0;
+        }
+
+        return &_buffer[offset];
+    }
+
+    void commit(size_t size) noexcept
+    {
+        _tail.store(_tail.load(std::memory_order_relaxed) + _skip + size, std::memory_order_release);
+    }
+
+    // logging thread only
+    template<typename F>
+    size_t drain(F&& f)
+    {
+        auto head = _head.load(std::memory_order_relaxed);
+        auto tail = _tail.load(std::memory_order_acquire);
+
+        size_t n = 0;
+        while (head != tail)
+        {
+            auto offset = head & _mask;
+
+            LogRecord record;
+            std::memcpy(&record.size, &_buffer[offset], sizeof(record.size));
+            if (0 == record.size)
+            {
+                head += _buffer.size() - offset;
+                continue;
+            }
+
+            std::memcpy(&record, &_buffer[offset], sizeof(record));
+            f(record, &_buffer[offset] + sizeof(record));
+
+            head += record.size;
+            ++n;
+        }
+
+        _head.store(head, std::memory_order_release);
+        return n;
+    }
+
+    bool empty() const noexcept
+    {
+        return _head.load(std::memory_order_relaxed) == _tail.load(std::memory_order_acquire);
+    }
+
+    uint64_t take_dropped() noexcept { return _dropped.exchange(0, std::memory_order_relaxed); }
+
+    // set once the producer thread exited, the ring goes away after its last drain
+    std::atomic<bool> orphaned{ false };
+private:
+    std::vector<char> _buffer;
+    size_t _mask;
+    uint32_t _id;
+    size_t _skip = 0;
+    std::atomic<size_t> _head{ 0 };
+    std::atomic<size_t> _tail{ 0 };
+    std::atomic<uint64_t> _dropped{ 0 };
+};
+}
+
+// each thread writes binary records into its own ring, one background thread formats them to the sink.
+// logging never waits, records are dropped and counted when a ring is full. the logging thread
+// sleeps while every ring is empty, the first record after that takes the lock to wake it
+class Logger
+{
+public:
+    static Logger& instance()
+    {
+        static Logger s_logger;
+        return s_logger;
+    }
+
+    // must be set before the first record
+    void set_sink(std::ostream& sink)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _sink = &sink;
+    }
+
+    // applies to rings of threads logging later
+    void set_ring_size(size_t size)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _ring_size = size;
+    }
+
+    // creates the ring of the calling thread ahead of its first record, see ThreadGuard
+    static void prepare_thread() { local(); }
+
+    template<typename ... Args>
+    static void log(LogLevel level, const Args& ... args)
+    {
+        write<typename detail::LogArg<Args>::Codec...>(level, detail::LogArg<Args>::prepare(args)...);
+    }
+private:
+    Logger() : _worker([this] { run(); }) {}
+
+    ~Logger()
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stopped = true;
+        }
+
+        _cnd.notify_one();
+        _worker.join();
+    }
+
+    struct LocalRing
+    {
+        std::shared_ptr<detail::LogRing> ring;
+
+        ~LocalRing() { ring->orphaned.store(true, std::memory_order_release); }
+    };
+
+    static detail::LogRing& local()
+    {
+        static thread_local LocalRing s_local{ instance().add_ring() };
+        return *s_local.ring;
+    }
+
+    std::shared_ptr<detail::LogRing> add_ring()
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        auto ring = std::make_shared<detail::LogRing>(_ring_size, _next_id++);
+        _rings.push_back(ring);
+        return ring;
+    }
+
+    template<typename ... Codecs, typename ... Args>
+    static void write(LogLevel level, const Args& ... args)
+    {
+        size_t size = sizeof(detail::LogRecord);
+        using expand = int[];
+        (void)expand{ 0, (size += Codecs::size(args), 0)... };
+        size = (size + 7) & ~size_t(7);
+
+        auto& ring = local();
+        auto p = ring.reserve(size);
+        if (!p)
+        {
+            return;
+        }
+
+        detail::LogRecord record;
+        record.size = static_cast<uint32_t>(size);
+        record.level = level;
+        record.time_us = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+        record.format = &Logger::format<Codecs...>;
+        std::memcpy(p, &record, sizeof(record));
+
+        auto payload = p + sizeof(record);
+        (void)expand{ 0, (payload = Codecs::encode(payload, args), 0)... };
+
+        ring.commit(size);
+        instance().wake();
+    }
+
+    // pairs with the fence in sleep, either the logging thread sees the record or we see it asleep
+    void wake()
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        if (_sleeping.load(std::memory_order_relaxed) && _sleeping.exchange(false))
+        {
+            // the logging thread is either waiting or about to, it checks _sleeping under the lock
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+            }
+
+            _cnd.notify_one();
+        }
+    }
+
+    // the logging thread, returns once a record may be pending or on stop
+    void sleep()
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _sleeping.store(true);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        // records committed before _sleeping was set came without a wake
+        for (auto&& ring : _rings)
+        {
+            if (!ring->empty() || ring->orphaned.load(std::memory_order_acquire))
+            {
+                _sleeping.store(false);
+                return;
+            }
+        }
+
+        _cnd.wait(lock, [this] { return _stopped || !_sleeping.load(); });
+        _sleeping.store(false);
+    }
+
+    template<typename ... Codecs>
+    static void format(std::ostream& os, const char* payload)
+    {
+        using expand = int[];
+        (void)expand{ 0, (payload = Codecs::decode(os, payload), 0)... };
+    }
+
+    static const char* level_name(LogLevel level) noexcept
+    {
+        static const char* s_names[] = { "TRACE", "DEBUG", "INFO", "WARN", "ERR", "NONE" };
+        return s_names[static_cast<size_t>(level)];
+    }
+
+    void run()
+    {
+        std::vector<std::shared_ptr<detail::LogRing>> rings;
+
+        while (true)
+        {
+            bool stopped;
+            std::ostream* sink;
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                stopped = _stopped;
+                sink = _sink;
+                rings = _rings;
+            }
+
+            size_t n = 0;
+            for (auto&& ring : rings)
+            {
+                // read before draining, so the last records of an exited thread are not lost
+                auto orphaned = ring->orphaned.load(std::memory_order_acquire);
+                n += drain(*sink, *ring);
+
+                if (orphaned)
+                {
+                    remove_ring(ring);
+                }
+            }
+
+            if (n > 0)
+            {
+                sink->flush();
+                continue;
+            }
+
+            if (stopped)
+            {
+                break;
+            }
+
+            sleep();
+        }
+    }
+
+    size_t drain(std::ostream& os, detail::LogRing& ring)
+    {
+        auto id = ring.id();
+
+        auto n = ring.drain([&os, id](const detail::LogRecord& record, const char* payload) {
+            auto seconds = record.time_us / 1000000;
+            auto micros = record.time_us % 1000000;
+
+            os << seconds << '.';
+            os.width(6);
+            os.fill('0');
+            os << micros << ' ' << level_name(record.level) << " [" << id << "] ";
+            record.format(os, payload);
+            os << '\n';
+        });
+
+        auto dropped = ring.take_dropped();
+        if (dropped > 0)
+        {
+            os << "[" << id << "] dropped " << dropped << " log records\n";
+            ++n;
+        }
+
+        return n;
+    }
+
+    void remove_ring(const std::shared_ptr<detail::LogRing>& ring)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        for (auto it = _rings.begin(); it != _rings.end(); ++it)
+        {
+            if (*it == ring)
+            {
+                _rings.erase(it);
+                break;
+            }
+        }
+    }
+
+    std::ostream* _sink = &std::clog;
+    size_t _ring_size = 256 * 1024;
+    std::mutex _mutex;
+    std::condition_variable _cnd;
+    bool _stopped = false;
+    std::atomic<bool> _sleeping{ false };
+    uint32_t _next_id = 0;
+    std::vector<std::shared_ptr<detail::LogRing>> _rings;
+    std::thread _worker;
+};
+
+}
@@ -1,5 +1,8 @@
 #pragma once
 
+#include <atomic>
+
+#include "asio_fiber/stop_scope.h"
 #include "asio_fiber/thread.h"
 
 namespace asio_fiber
@@ -11,16 +14,51 @@ class Object : public T, public StopToken
 public:
     static_assert(StopTraits<T>::value, "T must has stop or cancel or close");
 
+    // a smooth stop leaves the object alone while one is alive, and stops it when the last one ends
+    class Busy
+    {
+    public:
+        explicit Busy(Object& object) noexcept : _object(&object)
+        {
+            _object->_busy.fetch_add(1);
+        }
+
+        Busy(Busy&& other) noexcept : _object(other._object)
+        {
+            other._object = nullptr;
+        }
+
+        ~Busy()
+        {
+            if (_object)
+            {
+                _object->leave_busy();
+            }
+        }
+    private:
+        Busy(const Busy&) = delete;
+        void operator=(const Busy&) = delete;
+
+        Object* _object;
+    };
+
     template<typename ... Args>
     Object(Args&& ... args)
         : T(*ThreadContext::current(), std::forward<Args>(args)...)
     {
-        ThreadContext::current()->_stop_source.add_token(*this);
+        join_scope();
+    }
+
+    // takes over x, e.g. a socket handed over by post_socket. x must belong to the current thread
+    explicit Object(T&& x)
+        : T(std::move(x))
+    {
+        join_scope();
     }
 
     ~Object()
     {
-        if (this->is_linked())
+        if (_stop_source->remove_token(*this))
         {
             do_stop();
         }
@@ -32,16 +70,67 @@ public:
         return ThreadContext::current<C>();
     }
 
+    // e.g. from a request being read to its response being written, so that a smooth stop
+    // closes idle keep-alive connections at once and busy ones after their response.
+    // an object created during a smooth stop is stopped when its first busy section ends
+    Busy busy() noexcept
+    {
+        return Busy(*this);
+    }
+
     bool stop(StopMode mode) override
     {
+        if (StopMode::SMOOTH == mode)
+        {
+            _stop_pending.store(true);
+            if (_busy.load() > 0)
+            {
+                return false;
+            }
+        }
+
         do_stop();
         return true;
     }
 private:
+    // to the innermost StopScope of the running fiber, or to the whole thread
+    void join_scope()
+    {
+        _node = StopScope::current();
+        _stop_source = _node ? &_node->source() : &ThreadContext::current()->_stop_source;
+
+        // nothing new runs in a cancelled scope
+        if (!_stop_source->add_token(*this))
+        {
+            do_stop();
+            return;
+        }
+
+        // born during a smooth stop, the object goes once its first busy section ends
+        if (_stop_source->stopping())
+        {
+            _stop_pending.store(true);
+        }
+    }
+
+    // the token is still linked if stop ran while busy, whoever unlinks it stops the object
+    void leave_busy() noexcept
+    {
+        if (1 == _busy.fetch_sub(1) && _stop_pending.load() && _stop_source->remove_token(*this))
+        {
+            do_stop();
+        }
+    }
+
     void do_stop()
     {
         StopTraits<T>{}(static_cast<T&>(*this));
     }
+
+    std::shared_ptr<detail::StopNode> _node;
+    StopSource* _stop_source;
+    std::atomic<int> _busy{ 0 };
+    std::atomic<bool> _stop_pending{ false };
 };
 
 }
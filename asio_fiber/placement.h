@@ -0,0 +1,318 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <fstream>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "boost/system/error_code.hpp"
+
+#ifdef __linux__
+    #include <pthread.h>
+    #include <sched.h>
+    #include <sys/syscall.h>
+    #include <unistd.h>
+    #include <linux/mempolicy.h>
+#elif defined(_WIN32)
+    #include <windows.h>
+#endif
+
+namespace asio_fiber
+{
+
+// online cpus as the kernel reports them, read once. empty where unsupported
+class CpuTopology
+{
+public:
+    struct Cpu
+    {
+        int id;
+        int package;
+        int core;
+        int node;
+    };
+
+    static const CpuTopology& get()
+    {
+        static const CpuTopology s_topology;
+        return s_topology;
+    }
+
+    const std::vector<Cpu>& cpus() const noexcept { return _cpus; }
+
+    // -1 if unknown
+    int node_of(int cpu) const noexcept
+    {
+        for (auto&& c : _cpus)
+        {
+            if (c.id == cpu)
+            {
+                return c.node;
+            }
+        }
+
+        return -1;
+    }
+
+    std::vector<int> node_cpus(int node) const
+    {
+        std::vector<int> ids;
+        for (auto&& c : _cpus)
+        {
+            if (c.node == node)
+            {
+                ids.push_back(c.id);
+            }
+        }
+
+        return ids;
+    }
+
+    // the first hyperthread of every physical core, node by node, so a group fills one node first
+    std::vector<int> one_per_core() const
+    {
+        auto cpus = _cpus;
+        std::sort(cpus.begin(), cpus.end(), [](const Cpu& a, const Cpu& b) {
+            return std::tie(a.node, a.package, a.core, a.id) < std::tie(b.node, b.package, b.core, b.id);
+        });
+
+        std::vector<int> ids;
+        for (size_t i = 0; i < cpus.size(); ++i)
+        {
+            if (0 == i || cpus[i].package != cpus[i - 1].package || cpus[i].core != cpus[i - 1].core)
+            {
+                ids.push_back(cpus[i].id);
+            }
+        }
+
+        return ids;
+    }
+private:
+    CpuTopology()
+    {
+#ifdef __linux__
+        const std::string root = "/sys/devices/system/";
+
+        for (auto id : read_list(root + "cpu/online"))
+        {
+            auto dir = root + "cpu/cpu" + std::to_string(id) + "/topology/";
+            _cpus.push_back({ id, read_int(dir + "physical_package_id"), read_int(dir + "core_id"), -1 });
+        }
+
+        for (auto node : read_list(root + "node/possible"))
+        {
+            for (auto id : read_list(root + "node/node" + std::to_string(node) + "/cpulist"))
+            {
+                for (auto&& c : _cpus)
+                {
+                    if (c.id == id)
+                    {
+                        c.node = node;
+                    }
+                }
+            }
+        }
+#endif
+    }
+
+    // "0-3,8,10-11"
+    static std::vector<int> read_list(const std::string& path)
+    {
+        std::vector<int> ids;
+        std::ifstream in(path);
+        std::string item;
+
+        while (std::getline(in, item, ','))
+        {
+            auto dash = item.find('-');
+            try
+            {
+                auto first = std::stoi(item.substr(0, dash));
+                auto last = dash == std::string::npos ? first : std::stoi(item.substr(dash + 1));
+                for (auto id = first; id <= last; ++id)
+                {
+                    ids.push_back(id);
+                }
+            }
+            catch (const std::exception&) {}
+        }
+
+        return ids;
+    }
+
+    static int read_int(const std::string& path)
+    {
+        int value = -1;
+        std::ifstream in(path);
+        in >> value;
+        return value;
+    }
+
+    std::vector<Cpu> _cpus;
+};
+
+enum class PlacementKind
+{
+    // wherever the os schedules it
+    ANY,
+    // every thread on the whole cpu set, or one cpu of it each
+    CPU_SET,
+    // one physical core per thread
+    SPREAD_CORES,
+    // all threads on the cpus of one NUMA node
+    NUMA_NODE
+};
+
+// where the threads of a Thread or ThreadGroup run. a pinned thread also prefers the memory
+// of its NUMA node, so the fiber stacks, handlers and buffers it allocates stay local
+class Placement
+{
+public:
+    Placement() = default;
+
+    static Placement cpus(std::vector<int> ids, bool one_per_thread = false)
+    {
+        Placement p(PlacementKind::CPU_SET);
+        p._cpus = std::move(ids);
+        p._one_per_thread = one_per_thread;
+        return p;
+    }
+
+    static Placement spread_cores()
+    {
+        Placement p(PlacementKind::SPREAD_CORES);
+        p._cpus = CpuTopology::get().one_per_core();
+        p._one_per_thread = true;
+        return p;
+    }
+
+    static Placement numa_node(int node)
+    {
+        Placement p(PlacementKind::NUMA_NODE);
+        p._cpus = CpuTopology::get().node_cpus(node);
+        p._node = node;
+        return p;
+    }
+
+    PlacementKind kind() const noexcept { return _kind; }
+
+    // empty means no pinning
+    std::vector<int> cpus_for(size_t index) const
+    {
+        if (_cpus.empty() || !_one_per_thread)
+        {
+            return _cpus;
+        }
+
+        return { _cpus[index % _cpus.size()] };
+    }
+
+    // -1 means no memory preference
+    int node_for(size_t index) const
+    {
+        if (_node >= 0 || _cpus.empty())
+        {
+            return _node;
+        }
+
+        // only when every cpu of the thread is on the same node
+        auto ids = cpus_for(index);
+        auto& topology = CpuTopology::get();
+        auto node = topology.node_of(ids.front());
+        for (auto id : ids)
+        {
+            if (topology.node_of(id) != node)
+            {
+                return -1;
+            }
+        }
+
+        return node;
+    }
+
+    // binds the calling thread as the index-th thread of its group
+    boost::system::error_code apply(size_t index) const
+    {
+        if (PlacementKind::ANY == _kind)
+        {
+            return {};
+        }
+
+        auto ids = cpus_for(index);
+        if (ids.empty())
+        {
+            return boost::system::errc::make_error_code(boost::system::errc::invalid_argument);
+        }
+
+#ifdef __linux__
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (auto id : ids)
+        {
+            // CPU_SET does not check its bounds
+            if (id < 0 || id >= CPU_SETSIZE)
+            {
+                return boost::system::errc::make_error_code(boost::system::errc::invalid_argument);
+            }
+
+            CPU_SET(id, &set);
+        }
+
+        auto rc = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        if (rc != 0)
+        {
+            return { rc, boost::system::system_category() };
+        }
+
+        auto node = node_for(index);
+        if (node >= 0)
+        {
+            // preferred rather than bound, a full node falls back to the others instead of failing
+            unsigned long mask[16] = {};
+            const auto bits = sizeof(unsigned long) * 8;
+            if (static_cast<size_t>(node) >= sizeof(mask) * 8)
+            {
+                return boost::system::errc::make_error_code(boost::system::errc::invalid_argument);
+            }
+
+            mask[node / bits] |= 1UL << (node % bits);
+            if (syscall(SYS_set_mempolicy, MPOL_PREFERRED, mask, sizeof(mask) * 8) != 0)
+            {
+                return { errno, boost::system::system_category() };
+            }
+        }
+
+        return {};
+#elif defined(_WIN32)
+        // windows allocates on the node of the processor a thread runs on by default
+        DWORD_PTR mask = 0;
+        for (auto id : ids)
+        {
+            if (id < static_cast<int>(sizeof(mask) * 8))
+            {
+                mask |= DWORD_PTR(1) << id;
+            }
+        }
+
+        if (0 == SetThreadAffinityMask(GetCurrentThread(), mask))
+        {
+            return { static_cast<int>(GetLastError()), boost::system::system_category() };
+        }
+
+        return {};
+#else
+        return boost::system::errc::make_error_code(boost::system::errc::operation_not_supported);
+#endif
+    }
+private:
+    explicit Placement(PlacementKind kind) noexcept : _kind(kind) {}
+
+    PlacementKind _kind = PlacementKind::ANY;
+    std::vector<int> _cpus;
+    int _node = -1;
+    bool _one_per_thread = false;
+};
+
+}
@@ -0,0 +1,159 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+
+#include "boost/asio/io_context.hpp"
+#include "boost/fiber/algo/algorithm.hpp"
+#include "boost/fiber/scheduler.hpp"
+#include "boost/assert.hpp"
+
+#include "asio_fiber/algo.h"
+#include "asio_fiber/props.h"
+#include "asio_fiber/wheel.h"
+
+namespace asio_fiber
+{
+
+// picks per round while every class has ready fibers, LOW still gets 1 of 21 picks under full load
+struct PriorityWeights
+{
+    uint32_t high = 16;
+    uint32_t normal = 4;
+    uint32_t low = 1;
+};
+
+// Algorithm with one FIFO per FiberPriority, served by weighted round robin.
+// within a round higher classes go first, so a ready HIGH fiber waits for at most
+// normal + low picks, and no class with a weight starves
+class PriorityAlgorithm : public boost::fibers::algo::algorithm_with_properties<FiberProperties>
+{
+public:
+    explicit PriorityAlgorithm(const std::shared_ptr<boost::asio::io_context>& io_ctx,
+        const PollPolicy& policy = {}, AlgorithmStats* stats = nullptr, const PriorityWeights& weights = {})
+        : _poller(io_ctx, policy, stats)
+    {
+        // 0 would starve the class
+        _weights = { (std::max)(weights.high, 1u), (std::max)(weights.normal, 1u), (std::max)(weights.low, 1u) };
+        _credits = _weights;
+
+        _poller.set_wheel(&_wheel);
+        TimerWheel::current() = &_wheel;
+    }
+
+    ~PriorityAlgorithm() override
+    {
+        if (TimerWheel::current() == &_wheel)
+        {
+            TimerWheel::current() = nullptr;
+        }
+    }
+
+    void awakened(boost::fibers::context* fctx, FiberProperties& props) noexcept override
+    {
+        BOOST_ASSERT(fctx != nullptr);
+        BOOST_ASSERT(!fctx->ready_is_linked());
+
+        fctx->ready_link(_queues[level_of(props)]);
+        _poller.track(fctx);
+        _poller.set_ready(++_ready);
+    }
+
+    boost::fibers::context* pick_next() noexcept override
+    {
+        // keeps the coarse clock fresh while the loop never gets to suspend
+        if (0 == (++_picks & kRefreshMask))
+        {
+            _poller.refresh();
+        }
+
+        if (0 == _ready)
+        {
+            return nullptr;
+        }
+
+        bool ready = false;
+        auto dispatcher = _poller.budget_spent() ? _poller.yield_to_dispatcher(ready) : nullptr;
+        if (ready)
+        {
+            _poller.set_ready(dispatcher ? --_ready : _ready);
+            return dispatcher;
+        }
+
+        // a new round starts once no ready class has credits left
+        for (int round = 0; round < 2; ++round)
+        {
+            for (size_t level = 0; level < kLevels; ++level)
+            {
+                if (!_queues[level].empty() && _credits[level] > 0)
+                {
+                    --_credits[level];
+                    return pop(level);
+                }
+            }
+
+            _credits = _weights;
+        }
+
+        BOOST_ASSERT_MSG(false, "ready count out of sync");
+        return nullptr;
+    }
+
+    bool has_ready_fibers() const noexcept override
+    {
+        return _ready > 0;
+    }
+
+    // requeues a ready fiber whose class changed, a running or waiting one picks it up when awakened
+    void property_change(boost::fibers::context* fctx, FiberProperties& props) noexcept override
+    {
+        if (!fctx->ready_is_linked())
+        {
+            return;
+        }
+
+        fctx->ready_unlink();
+        fctx->ready_link(_queues[level_of(props)]);
+    }
+
+    void suspend_until(std::chrono::steady_clock::time_point const& abs_time) noexcept override
+    {
+        _poller.suspend_until(abs_time);
+    }
+
+    void notify() noexcept override
+    {
+        _poller.notify();
+    }
+private:
+    static constexpr size_t kLevels = 3;
+    static constexpr uint32_t kRefreshMask = 63;
+
+    static size_t level_of(const FiberProperties& props) noexcept
+    {
+        return static_cast<size_t>(props.priority());
+    }
+
+    boost::fibers::context* pop(size_t level) noexcept
+    {
+        auto fctx = &(_queues[level].front());
+        _queues[level].pop_front();
+
+        _poller.set_ready(--_ready);
+        _poller.count_switch();
+        return fctx;
+    }
+
+    IoPoller _poller;
+    TimerWheel _wheel;
+    std::array<boost::fibers::scheduler::ready_queue_type, kLevels> _queues;
+    std::array<uint32_t, kLevels> _weights;
+    std::array<uint32_t, kLevels> _credits;
+    uint64_t _ready = 0;
+    uint32_t _picks = 0;
+};
+
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstdint>
+
+#include "boost/fiber/context.hpp"
+#include "boost/fiber/properties.hpp"
+
+namespace asio_fiber
+{
+
+// scheduling class under PriorityAlgorithm, ignored by the other algorithms
+enum class FiberPriority : uint8_t
+{
+    HIGH,
+    NORMAL,
+    LOW
+};
+
+class FiberProperties : public boost::fibers::fiber_properties
+{
+public:
+    explicit FiberProperties(boost::fibers::context* fctx) noexcept : boost::fibers::fiber_properties(fctx) {}
+
+    // pinned fiber never migrate to other thread
+    bool pinned() const noexcept { return _pinned; }
+    void pin(bool pinned = true) noexcept { _pinned = pinned; }
+
+    FiberPriority priority() const noexcept { return _priority; }
+
+    // a ready fiber moves to its new class at once, see PriorityAlgorithm::property_change
+    void set_priority(FiberPriority priority) noexcept
+    {
+        if (priority != _priority)
+        {
+            _priority = priority;
+            notify();
+        }
+    }
+private:
+    bool _pinned = false;
+    FiberPriority _priority = FiberPriority::NORMAL;
+};
+
+// nullptr if the scheduling algorithm of this thread has no FiberProperties
+inline FiberProperties* this_fiber_properties() noexcept
+{
+    return dynamic_cast<FiberProperties*>(boost::fibers::context::active()->get_properties());
+}
+
+// pin the running fiber to the current thread, e.g. before creating thread-bound asio objects
+inline void pin_this_fiber(bool pinned = true) noexcept
+{
+    auto props = this_fiber_properties();
+    if (props)
+    {
+        props->pin(pinned);
+    }
+}
+
+// the running fiber keeps its class across every wait, e.g. a health check sets HIGH first thing
+inline void set_this_fiber_priority(FiberPriority priority) noexcept
+{
+    auto props = this_fiber_properties();
+    if (props)
+    {
+        props->set_priority(priority);
+    }
+}
+
+}
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include "boost/asio/cancellation_signal.hpp"
+#include "boost/fiber/fss.hpp"
+
+#include "asio_fiber/stop_token.h"
+
+namespace asio_fiber
+{
+
+class StopScope;
+
+namespace detail
+{
+// the yield() waiting inside one StopScope, at most one since a scope belongs to one fiber.
+// linked to the scope once, a yield only swaps its cancellation signal in and out, without
+// a lock. a stop on another thread makes the yield wait until it is done emitting
+class YieldLink : public StopToken
+{
+public:
+    // false if the scope is cancelled already, the caller then cancels the operation itself
+    bool attach(boost::asio::cancellation_signal* signal) noexcept
+    {
+        _signal.store(signal);
+        if (!_forced.load())
+        {
+            return true;
+        }
+
+        // raced with a stop, whoever takes the signal back cancels
+        return nullptr == _signal.exchange(nullptr);
+    }
+
+    void detach() noexcept
+    {
+        if (nullptr == _signal.exchange(nullptr))
+        {
+            while (_emitting.load() > 0)
+            {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    bool stop(StopMode mode) override
+    {
+        if (StopMode::FORCE != mode)
+        {
+            return false;
+        }
+
+        _emitting.fetch_add(1);
+        _forced.store(true);
+
+        auto signal = _signal.exchange(nullptr);
+        if (signal)
+        {
+            signal->emit(boost::asio::cancellation_type::total);
+        }
+
+        _emitting.fetch_sub(1);
+        return true;
+    }
+private:
+    std::atomic<boost::asio::cancellation_signal*> _signal{ nullptr };
+    std::atomic<bool> _forced{ false };
+    std::atomic<int> _emitting{ 0 };
+};
+
+// base of DeadlineScope and StopScope. the innermost scope of the running fiber, whichever
+// kind came last, carries the deadline and the stop scope in force, so that a yield() finds
+// both with one fiber local lookup. scopes live on the fiber stack and nest strictly
+class ScopeFrame
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    // innermost scope of the running fiber, null outside of any
+    static ScopeFrame* top() { return storage().get(); }
+
+    Clock::time_point frame_deadline() const noexcept { return _deadline; }
+    StopScope* frame_stop_scope() const noexcept { return _stop_scope; }
+    YieldLink* frame_yield_link() const noexcept { return _yield_link; }
+protected:
+    // inherits the deadline and stop scope of the enclosing frame, the derived scope narrows them
+    ScopeFrame()
+        : _parent(top()),
+        _deadline(_parent ? _parent->_deadline : (Clock::time_point::max)()),
+        _stop_scope(_parent ? _parent->_stop_scope : nullptr),
+        _yield_link(_parent ? _parent->_yield_link : nullptr)
+    {
+        storage().reset(this);
+    }
+
+    ~ScopeFrame()
+    {
+        storage().reset(_parent);
+    }
+
+    ScopeFrame* _parent;
+    Clock::time_point _deadline;
+    StopScope* _stop_scope;
+    YieldLink* _yield_link;
+private:
+    ScopeFrame(const ScopeFrame&) = delete;
+    void operator=(const ScopeFrame&) = delete;
+
+    // the fiber local slot only points to the innermost frame
+    static void no_cleanup(ScopeFrame*) noexcept {}
+
+    static boost::fibers::fiber_specific_ptr<ScopeFrame>& storage()
+    {
+        static boost::fibers::fiber_specific_ptr<ScopeFrame> s_storage(&ScopeFrame::no_cleanup);
+        return s_storage;
+    }
+};
+}
+
+}
@@ -0,0 +1,297 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "boost/asio/io_context.hpp"
+#include "boost/fiber/algo/algorithm.hpp"
+#include "boost/fiber/detail/context_spinlock_queue.hpp"
+#include "boost/fiber/scheduler.hpp"
+#include "boost/assert.hpp"
+
+#include "asio_fiber/algo.h"
+#include "asio_fiber/props.h"
+
+namespace asio_fiber
+{
+
+class SharedAlgorithm;
+
+// threads of one group run the same io_context and share one ready queue.
+// only one idle thread (the leader) waits in the io_context, other idle threads
+// wait on their own condition variable, so that a wakeup always reaches its thread.
+// only the leader runs the completions, a wakeup posted for it is never run by another thread.
+// a busy thread whose poll budget is spent polls only while no thread is the leader
+class SharedGroup
+{
+public:
+    // io_ctx outlives the group, every SharedAlgorithm holds it
+    explicit SharedGroup(boost::asio::io_context& io_ctx) noexcept : _io_ctx(&io_ctx) {}
+
+    void push(boost::fibers::context* fctx) { _ready_queue.push(fctx); }
+    boost::fibers::context* pop() noexcept { return _ready_queue.pop(); }
+    bool empty() const noexcept { return _ready_queue.empty(); }
+
+    // some thread should pick up the fiber just pushed
+    void wake_one(SharedAlgorithm* self) noexcept;
+
+    void wait_until(SharedAlgorithm* self, std::chrono::steady_clock::time_point const& abs_time) noexcept;
+    // once the poll budget of self is spent, polls unless the leader waits in the io_context
+    void budget_poll(SharedAlgorithm* self, std::chrono::steady_clock::time_point const& abs_time) noexcept;
+    void notify(SharedAlgorithm* self) noexcept;
+private:
+    void promote_follower() noexcept;
+
+    boost::asio::io_context* _io_ctx;
+    boost::fibers::detail::context_spinlock_queue _ready_queue;
+
+    std::mutex _mutex;
+    SharedAlgorithm* _leader = nullptr;
+    std::vector<SharedAlgorithm*> _followers;
+    // leader and followers, lets wake_one skip the lock while every thread is busy
+    std::atomic<int> _idle_count{ 0 };
+};
+
+class SharedAlgorithm : public boost::fibers::algo::algorithm_with_properties<FiberProperties>
+{
+public:
+    SharedAlgorithm(const std::shared_ptr<boost::asio::io_context>& io_ctx, const std::shared_ptr<SharedGroup>& group,
+        const PollPolicy& policy = {}, AlgorithmStats* stats = nullptr)
+        : _poller(io_ctx, policy, stats), _group(group) {}
+
+    void awakened(boost::fibers::context* fctx, FiberProperties& props) noexcept override
+    {
+        BOOST_ASSERT(fctx != nullptr);
+        _poller.track(fctx);
+
+        if (fctx->is_context(boost::fibers::type::pinned_context) || props.pinned())
+        {
+            BOOST_ASSERT(!fctx->ready_is_linked());
+            fctx->ready_link(_pinned_queue);
+            return;
+        }
+
+        fctx->detach();
+        _group->push(fctx);
+        _group->wake_one(this);
+    }
+
+    boost::fibers::context* pick_next() noexcept override
+    {
+        bool ready = false;
+        auto dispatcher = has_ready_fibers() && _poller.budget_spent() ? _poller.yield_to_dispatcher(ready) : nullptr;
+        if (ready)
+        {
+            return dispatcher;
+        }
+
+        auto fctx = pick();
+        if (fctx)
+        {
+            _poller.count_switch();
+        }
+
+        return fctx;
+    }
+
+    bool has_ready_fibers() const noexcept override
+    {
+        return !_pinned_queue.empty() || !_group->empty();
+    }
+
+    void suspend_until(std::chrono::steady_clock::time_point const& abs_time) noexcept override
+    {
+        if (_poller.poll_due())
+        {
+            _group->budget_poll(this, abs_time);
+            return;
+        }
+
+        _group->wait_until(this, abs_time);
+    }
+
+    void notify() noexcept override
+    {
+        _group->notify(this);
+    }
+private:
+    friend class SharedGroup;
+
+    boost::fibers::context* pick() noexcept
+    {
+        _pinned_first = !_pinned_first;
+
+        auto fctx = _pinned_first ? pop_pinned() : nullptr;
+        if (fctx)
+        {
+            return fctx;
+        }
+
+        fctx = _group->pop();
+        if (fctx)
+        {
+            boost::fibers::context::active()->attach(fctx);
+            return fctx;
+        }
+
+        return pop_pinned();
+    }
+
+    boost::fibers::context* pop_pinned() noexcept
+    {
+        if (_pinned_queue.empty())
+        {
+            return nullptr;
+        }
+
+        auto fctx = &(_pinned_queue.front());
+        _pinned_queue.pop_front();
+        return fctx;
+    }
+
+    IoPoller _poller;
+    std::shared_ptr<SharedGroup> _group;
+    boost::fibers::scheduler::ready_queue_type _pinned_queue;
+    bool _pinned_first = false;
+
+    // guarded by SharedGroup::_mutex
+    std::condition_variable _cnd;
+    bool _notified = false;
+};
+
+inline void SharedGroup::wake_one(SharedAlgorithm* self) noexcept
+{
+    if (_idle_count.load() <= 0)
+    {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    if (!_followers.empty())
+    {
+        auto follower = _followers.back();
+        _followers.pop_back();
+        follower->_notified = true;
+        follower->_cnd.notify_one();
+    }
+    else if (_leader && _leader != self && !_leader->_notified)
+    {
+        _leader->_notified = true;
+        _leader->_poller.notify();
+    }
+}
+
+inline void SharedGroup::wait_until(SharedAlgorithm* self, std::chrono::steady_clock::time_point const& abs_time) noexcept
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    if (self->_notified)
+    {
+        self->_notified = false;
+        return;
+    }
+
+    // a fiber may have been pushed before we were counted as idle
+    _idle_count.fetch_add(1);
+    if (!empty() || _io_ctx->stopped())
+    {
+        _idle_count.fetch_sub(1);
+        return;
+    }
+
+    if (!_leader)
+    {
+        _leader = self;
+
+        while (!self->_notified && !self->has_ready_fibers() && !_io_ctx->stopped()
+            && std::chrono::steady_clock::now() < abs_time)
+        {
+            lock.unlock();
+            self->_poller.suspend_until(abs_time);
+            lock.lock();
+        }
+
+        _leader = nullptr;
+        _idle_count.fetch_sub(1);
+        self->_notified = false;
+        promote_follower();
+        return;
+    }
+
+    _followers.push_back(self);
+    self->_cnd.wait_until(lock, abs_time, [self] { return self->_notified; });
+
+    for (auto it = _followers.begin(); it != _followers.end(); ++it)
+    {
+        if (*it == self)
+        {
+            _followers.erase(it);
+            break;
+        }
+    }
+
+    _idle_count.fetch_sub(1);
+    self->_notified = false;
+}
+
+inline void SharedGroup::budget_poll(SharedAlgorithm* self, std::chrono::steady_clock::time_point const& abs_time) noexcept
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    // the leader runs the completions, polling here could run its wakeup
+    if (_leader)
+    {
+        self->_poller.skip_poll();
+        return;
+    }
+
+    // leads for one poll, the poller does not block while its poll is due
+    _leader = self;
+    lock.unlock();
+    self->_poller.suspend_until(abs_time);
+    lock.lock();
+
+    _leader = nullptr;
+    self->_notified = false;
+    promote_follower();
+}
+
+inline void SharedGroup::notify(SharedAlgorithm* self) noexcept
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    if (self->_notified)
+    {
+        return;
+    }
+
+    self->_notified = true;
+
+    if (_leader == self)
+    {
+        self->_poller.notify();
+    }
+    else
+    {
+        self->_cnd.notify_one();
+    }
+}
+
+inline void SharedGroup::promote_follower() noexcept
+{
+    if (_followers.empty())
+    {
+        return;
+    }
+
+    auto follower = _followers.back();
+    _followers.pop_back();
+    follower->_notified = true;
+    follower->_cnd.notify_one();
+}
+
+}
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "boost/context/stack_context.hpp"
+#include "boost/context/stack_traits.hpp"
+#include "boost/fiber/fixedsize_stack.hpp"
+#include "boost/fiber/protected_fixedsize_stack.hpp"
+
+namespace asio_fiber
+{
+
+struct StackPoolOptions
+{
+    // size class of every pooled stack
+    size_t stack_size = boost::context::stack_traits::default_size();
+    // max free stacks kept for reuse
+    size_t max_cached = 256;
+    // guard page below each stack, costs an extra mprotect per miss only
+    bool guard_page = false;
+};
+
+struct StackPoolStats
+{
+    size_t hits = 0;
+    size_t misses = 0;
+    size_t cached = 0;
+};
+
+// free stacks of one size class, reused by fibers spawned on a thread.
+// a stack may be returned by another thread once its fiber migrated, hence the lock
+class StackPool
+{
+public:
+    explicit StackPool(const StackPoolOptions& options = {}) : _options(options)
+    {
+        _cache.reserve(_options.max_cached);
+    }
+
+    ~StackPool()
+    {
+        for (auto&& sctx : _cache)
+        {
+            release(sctx);
+        }
+    }
+
+    boost::context::stack_context allocate()
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (!_cache.empty())
+            {
+                auto sctx = _cache.back();
+                _cache.pop_back();
+                ++_stats.hits;
+                return sctx;
+            }
+
+            ++_stats.misses;
+        }
+
+        if (_options.guard_page)
+        {
+            return boost::fibers::protected_fixedsize_stack(_options.stack_size).allocate();
+        }
+
+        return boost::fibers::fixedsize_stack(_options.stack_size).allocate();
+    }
+
+    void deallocate(boost::context::stack_context& sctx) noexcept
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (_cache.size() < _options.max_cached)
+            {
+                _cache.push_back(sctx);
+                return;
+            }
+        }
+
+        release(sctx);
+    }
+
+    StackPoolStats get_stats() const
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        auto stats = _stats;
+        stats.cached = _cache.size();
+        return stats;
+    }
+
+    const StackPoolOptions& get_options() const noexcept { return _options; }
+private:
+    void release(boost::context::stack_context& sctx) noexcept
+    {
+        if (_options.guard_page)
+        {
+            boost::fibers::protected_fixedsize_stack(_options.stack_size).deallocate(sctx);
+        }
+        else
+        {
+            boost::fibers::fixedsize_stack(_options.stack_size).deallocate(sctx);
+        }
+    }
+
+    StackPoolOptions _options;
+    mutable std::mutex _mutex;
+    std::vector<boost::context::stack_context> _cache;
+    StackPoolStats _stats;
+};
+
+// StackAllocator of boost.fiber backed by a StackPool
+class PooledStack
+{
+public:
+    explicit PooledStack(const std::shared_ptr<StackPool>& pool) noexcept : _pool(pool) {}
+
+    boost::context::stack_context allocate() { return _pool->allocate(); }
+    void deallocate(boost::context::stack_context& sctx) noexcept { _pool->deallocate(sctx); }
+private:
+    std::shared_ptr<StackPool> _pool;
+};
+
+}
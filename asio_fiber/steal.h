@@ -0,0 +1,294 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "boost/asio/io_context.hpp"
+#include "boost/fiber/algo/algorithm.hpp"
+#include "boost/fiber/detail/context_spinlock_queue.hpp"
+#include "boost/fiber/scheduler.hpp"
+#include "boost/assert.hpp"
+
+#include "asio_fiber/algo.h"
+#include "asio_fiber/props.h"
+
+namespace asio_fiber
+{
+
+class StealingAlgorithm;
+
+// threads of one group steal ready fibers from each other.
+// wake_one runs on every awakened while a member is idle, so it reads the members from a
+// copy without the lock. join and leave publish a new copy and free the old one once no
+// wake_one is still reading it
+class StealGroup
+{
+public:
+    StealGroup() = default;
+
+    ~StealGroup()
+    {
+        delete _view.load();
+    }
+
+    void join(StealingAlgorithm* algo)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _members.push_back(algo);
+        publish();
+    }
+
+    void leave(StealingAlgorithm* algo);
+
+    boost::fibers::context* steal(StealingAlgorithm* thief) noexcept;
+
+    bool has_idle() const noexcept { return _idle_count.load() > 0; }
+
+    void enter_idle(StealingAlgorithm* algo) noexcept;
+    void leave_idle(StealingAlgorithm* algo) noexcept;
+
+    // wake one idle member so that it can steal from the busy one
+    void wake_one(StealingAlgorithm* busy) noexcept;
+private:
+    using Members = std::vector<StealingAlgorithm*>;
+
+    StealGroup(const StealGroup&) = delete;
+    void operator=(const StealGroup&) = delete;
+
+    // under _mutex
+    void publish()
+    {
+        auto old = _view.exchange(new Members(_members));
+        while (_readers.load() > 0)
+        {
+            std::this_thread::yield();
+        }
+
+        delete old;
+    }
+
+    std::mutex _mutex;
+    Members _members;
+    size_t _next_victim = 0;
+    std::atomic<int> _idle_count{ 0 };
+    // what wake_one reads, with the number of wake_one calls reading it
+    std::atomic<const Members*> _view{ nullptr };
+    std::atomic<int> _readers{ 0 };
+};
+
+class StealingAlgorithm : public boost::fibers::algo::algorithm_with_properties<FiberProperties>
+{
+public:
+    StealingAlgorithm(const std::shared_ptr<boost::asio::io_context>& io_ctx, const std::shared_ptr<StealGroup>& group,
+        const PollPolicy& policy = {}, AlgorithmStats* stats = nullptr)
+        : _poller(io_ctx, policy, stats), _group(group)
+    {
+        _group->join(this);
+    }
+
+    ~StealingAlgorithm() override
+    {
+        _group->leave(this);
+    }
+
+    void awakened(boost::fibers::context* fctx, FiberProperties& props) noexcept override
+    {
+        BOOST_ASSERT(fctx != nullptr);
+        _poller.track(fctx);
+
+        if (fctx->is_context(boost::fibers::type::pinned_context) || props.pinned())
+        {
+            BOOST_ASSERT(!fctx->ready_is_linked());
+            fctx->ready_link(_pinned_queue);
+            return;
+        }
+
+        fctx->detach();
+        _stealable_queue.push(fctx);
+
+        if (_group->has_idle())
+        {
+            _group->wake_one(this);
+        }
+    }
+
+    boost::fibers::context* pick_next() noexcept override
+    {
+        bool ready = false;
+        auto dispatcher = has_ready_fibers() && _poller.budget_spent() ? _poller.yield_to_dispatcher(ready) : nullptr;
+        if (ready)
+        {
+            return dispatcher;
+        }
+
+        auto fctx = pick();
+        if (fctx)
+        {
+            _poller.count_switch();
+        }
+
+        return fctx;
+    }
+
+    bool has_ready_fibers() const noexcept override
+    {
+        return !_pinned_queue.empty() || !_stealable_queue.empty();
+    }
+
+    void suspend_until(std::chrono::steady_clock::time_point const& abs_time) noexcept override
+    {
+        // not idle, the fibers are still ready
+        if (_poller.poll_due())
+        {
+            _poller.suspend_until(abs_time);
+            return;
+        }
+
+        _group->enter_idle(this);
+
+        // a fiber may have become stealable before we were marked as idle
+        auto fctx = _group->steal(this);
+        if (fctx)
+        {
+            _stealable_queue.push(fctx);
+        }
+        else
+        {
+            _poller.suspend_until(abs_time);
+        }
+
+        _group->leave_idle(this);
+    }
+
+    void notify() noexcept override
+    {
+        _poller.notify();
+    }
+private:
+    friend class StealGroup;
+
+    boost::fibers::context* pick() noexcept
+    {
+        _pinned_first = !_pinned_first;
+
+        auto fctx = _pinned_first ? pop_pinned() : nullptr;
+        if (fctx)
+        {
+            return fctx;
+        }
+
+        fctx = _stealable_queue.pop();
+        if (!fctx)
+        {
+            fctx = _group->steal(this);
+        }
+
+        if (fctx)
+        {
+            boost::fibers::context::active()->attach(fctx);
+            return fctx;
+        }
+
+        return pop_pinned();
+    }
+
+    boost::fibers::context* pop_pinned() noexcept
+    {
+        if (_pinned_queue.empty())
+        {
+            return nullptr;
+        }
+
+        auto fctx = &(_pinned_queue.front());
+        _pinned_queue.pop_front();
+        return fctx;
+    }
+
+    IoPoller _poller;
+    std::shared_ptr<StealGroup> _group;
+    boost::fibers::scheduler::ready_queue_type _pinned_queue;
+    boost::fibers::detail::context_spinlock_queue _stealable_queue;
+    std::atomic<bool> _idle{ false };
+    bool _pinned_first = false;
+};
+
+inline void StealGroup::leave(StealingAlgorithm* algo)
+{
+    leave_idle(algo);
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    for (auto it = _members.begin(); it != _members.end(); ++it)
+    {
+        if (*it == algo)
+        {
+            _members.erase(it);
+            break;
+        }
+    }
+
+    publish();
+}
+
+inline boost::fibers::context* StealGroup::steal(StealingAlgorithm* thief) noexcept
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    auto n = _members.size();
+    for (size_t i = 0; i < n; ++i)
+    {
+        auto victim = _members[(_next_victim + i) % n];
+        if (victim == thief)
+        {
+            continue;
+        }
+
+        auto fctx = victim->_stealable_queue.pop();
+        if (fctx)
+        {
+            _next_victim = (_next_victim + i + 1) % n;
+            return fctx;
+        }
+    }
+
+    return nullptr;
+}
+
+inline void StealGroup::enter_idle(StealingAlgorithm* algo) noexcept
+{
+    if (!algo->_idle.exchange(true, std::memory_order_acq_rel))
+    {
+        _idle_count.fetch_add(1);
+    }
+}
+
+inline void StealGroup::leave_idle(StealingAlgorithm* algo) noexcept
+{
+    if (algo->_idle.exchange(false, std::memory_order_acq_rel))
+    {
+        _idle_count.fetch_sub(1);
+    }
+}
+
+inline void StealGroup::wake_one(StealingAlgorithm* busy) noexcept
+{
+    // counted before the load, so that a publish either waits for us or is seen by us
+    _readers.fetch_add(1);
+
+    auto members = _view.load();
+    for (auto member : *members)
+    {
+        if (member != busy && member->_idle.exchange(false, std::memory_order_acq_rel))
+        {
+            _idle_count.fetch_sub(1);
+            member->notify();
+            break;
+        }
+    }
+
+    _readers.fetch_sub(1);
+}
+
+}
@@ -0,0 +1,189 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <utility>
+
+#include "asio_fiber/scope_frame.h"
+#include "asio_fiber/stop_token.h"
+
+namespace asio_fiber
+{
+
+namespace detail
+{
+// one level of the stop tree, a token of its parent level. alive while its StopScope,
+// the scopes nested in it or the Objects bound to it are
+class StopNode : public StopToken
+{
+public:
+    StopNode(std::shared_ptr<StopNode> parent, StopSource* root)
+        : _parent(std::move(parent)), _owner(_parent ? &_parent->_source : root)
+    {
+        // born inside a cancelled or draining level
+        if (_owner && !_owner->add_token(*this))
+        {
+            stop(StopMode::FORCE);
+        }
+        else if (_owner && _owner->stopping())
+        {
+            stop(StopMode::SMOOTH);
+        }
+    }
+
+    ~StopNode() override
+    {
+        if (_owner)
+        {
+            _owner->remove_token(*this);
+        }
+    }
+
+    StopSource& source() noexcept { return _source; }
+
+    bool stopping() const noexcept { return _state.load(std::memory_order_acquire) != NONE; }
+
+    // nested levels are tokens of this one, so the whole subtree goes in one pass
+    bool stop(StopMode mode) override
+    {
+        auto state = StopMode::FORCE == mode ? FORCED : SMOOTH;
+        if (_state.load(std::memory_order_acquire) < state)
+        {
+            _state.store(state, std::memory_order_release);
+            _source.stop(mode);
+        }
+
+        // linked until forced, so that whatever the scope creates meanwhile is still reached
+        return StopMode::FORCE == mode;
+    }
+private:
+    enum State
+    {
+        NONE,
+        SMOOTH,
+        FORCED
+    };
+
+    std::shared_ptr<StopNode> _parent;
+    StopSource* _owner;
+    StopSource _source;
+    std::atomic<int> _state{ NONE };
+};
+
+template<typename F>
+class ScopedCall;
+}
+
+// stops one StopScope from outside of it, nothing once the scope and all it holds are gone.
+// like the scope itself it must be used on the thread running the scope, e.g. through ThreadContext::post
+class StopHandle
+{
+public:
+    StopHandle() = default;
+    explicit StopHandle(const std::shared_ptr<detail::StopNode>& node) noexcept : _node(node) {}
+
+    void stop(StopMode mode = StopMode::FORCE)
+    {
+        auto node = _node.lock();
+        if (node)
+        {
+            node->stop(mode);
+        }
+    }
+
+    bool stopping() const noexcept
+    {
+        auto node = _node.lock();
+        return node && node->stopping();
+    }
+private:
+    std::weak_ptr<detail::StopNode> _node;
+};
+
+// a node of the stop tree of a thread, e.g. per listener, per connection and per request.
+// nests in the innermost scope of the running fiber, or directly in its ThreadContext.
+// Objects and yield() operations bind to the innermost scope, fibers launched by
+// ThreadContext::spawn start inside the scope of their parent. lives on the fiber stack
+class StopScope : private detail::ScopeFrame
+{
+public:
+    StopScope() : StopScope(std::make_shared<detail::StopNode>(current(), thread_source())) {}
+
+    ~StopScope()
+    {
+        _node->source().remove_token(_link);
+    }
+
+    // FORCE cancels the Objects and yield() operations of this scope and of all scopes nested in it,
+    // and whatever they start from then on. SMOOTH stops them like ThreadContext::stop does
+    void stop(StopMode mode = StopMode::FORCE) { _node->stop(mode); }
+
+    // a stop has reached this scope, directly or from an enclosing one
+    bool stopping() const noexcept { return _node->stopping(); }
+
+    StopHandle get_handle() const noexcept { return StopHandle(_node); }
+
+    // innermost node of the running fiber, null outside of any scope
+    static std::shared_ptr<detail::StopNode> current()
+    {
+        auto frame = top();
+        auto scope = frame ? frame->frame_stop_scope() : nullptr;
+        return scope ? scope->_node : nullptr;
+    }
+
+    // stop source of the ThreadContext on this thread, outermost scopes nest in it
+    static StopSource*& thread_source() noexcept
+    {
+        static thread_local StopSource* s_source = nullptr;
+        return s_source;
+    }
+private:
+    template<typename F>
+    friend class detail::ScopedCall;
+
+    // enters node without nesting, for a fiber launched inside it
+    explicit StopScope(std::shared_ptr<detail::StopNode> node) : _node(std::move(node))
+    {
+        _stop_scope = this;
+        _yield_link = &_link;
+
+        // the yields of this fiber share one link, nothing is locked per operation
+        if (!_node->source().add_token(_link))
+        {
+            _link.stop(StopMode::FORCE);
+        }
+    }
+
+    std::shared_ptr<detail::StopNode> _node;
+    detail::YieldLink _link;
+};
+
+namespace detail
+{
+// runs f of a spawned fiber inside the stop scope captured from its parent
+template<typename F>
+class ScopedCall
+{
+public:
+    template<typename T>
+    ScopedCall(T&& f, std::shared_ptr<StopNode> node) : _f(std::forward<T>(f)), _node(std::move(node)) {}
+
+    template<typename ... Args>
+    void operator()(Args&& ... args)
+    {
+        if (!_node)
+        {
+            _f(std::forward<Args>(args)...);
+            return;
+        }
+
+        StopScope scope(std::move(_node));
+        _f(std::forward<Args>(args)...);
+    }
+private:
+    F _f;
+    std::shared_ptr<StopNode> _node;
+};
+}
+
+}
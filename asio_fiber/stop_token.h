@@ -1,5 +1,8 @@
 #pragma once
 
+#include <condition_variable>
+#include <mutex>
+#include <thread>
 #include <type_traits>
 
 #include "boost/intrusive/list.hpp"
@@ -10,7 +13,9 @@ namespace asio_fiber
 
 enum class StopMode
 {
+    // cancel everything at once
     FORCE,
+    // let what is in progress finish, see Object::busy
     SMOOTH
 };
 
@@ -19,9 +24,14 @@ class StopToken
 {
 public:
     virtual ~StopToken() = default;
+
+    // false keeps the token for a later stop, only honored for StopMode::SMOOTH
     virtual bool stop(StopMode mode) = 0;
 };
 
+// tokens are stopped outside of the lock, one at a time, so that a token may add or remove
+// tokens of its own source. a token removed on another thread while it is being stopped is
+// only unlinked once its stop has returned, so that it may be destroyed right after
 class StopSource
 {
 public:
@@ -29,20 +39,118 @@ public:
 
     void stop(StopMode mode = StopMode::FORCE)
     {
-        for (auto&& token : _tokens)
+        std::unique_lock<std::mutex> lock(_mutex);
+
+        _stopping = true;
+        if (StopMode::FORCE == mode)
         {
-            token.stop(mode);
+            _forced = true;
         }
 
-        _tokens.clear();
+        if (_in_stop)
+        {
+            // from a token of the running pass, which picks up a forced stop for the tokens left
+            if (_stop_thread == std::this_thread::get_id())
+            {
+                return;
+            }
+
+            _cnd.wait(lock, [this] { return !_in_stop; });
+        }
+
+        _in_stop = true;
+        _stop_thread = std::this_thread::get_id();
+
+        TokenList pending;
+        pending.splice(pending.end(), _tokens);
+
+        while (!pending.empty())
+        {
+            auto& token = pending.front();
+            pending.pop_front();
+
+            auto token_mode = _forced ? StopMode::FORCE : mode;
+            _running = &token;
+
+            lock.unlock();
+            auto done = token.stop(token_mode) || StopMode::FORCE == token_mode;
+            lock.lock();
+
+            // a token kept by a smooth stop is forced in this pass if a forced stop came meanwhile
+            if (!done && !_running_removed)
+            {
+                (_forced ? pending : _tokens).push_back(token);
+            }
+
+            _running = nullptr;
+            _running_removed = false;
+            _cnd.notify_all();
+        }
+
+        _in_stop = false;
+        _cnd.notify_all();
     }
 
-    void add_token(StopToken& token) noexcept
+    // false once force stopped, the token is not added and should stop itself
+    bool add_token(StopToken& token) noexcept
     {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_forced)
+        {
+            return false;
+        }
+
         _tokens.push_back(token);
+        return true;
+    }
+
+    // stopped in any mode, tokens added during a smooth stop are not told about it
+    bool stopping() noexcept
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _stopping;
+    }
+
+    // false if the token has been stopped already
+    bool remove_token(StopToken& token) noexcept
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+
+        if (&token == _running)
+        {
+            // from its own stop, it is not kept
+            if (_stop_thread == std::this_thread::get_id())
+            {
+                _running_removed = true;
+                return false;
+            }
+
+            _cnd.wait(lock, [this, &token] { return &token != _running; });
+        }
+
+        if (!token.is_linked())
+        {
+            return false;
+        }
+
+        token.unlink();
+        return true;
     }
 private:
-    boost::intrusive::list<StopToken, boost::intrusive::constant_time_size<false>> _tokens;
+    using TokenList = boost::intrusive::list<StopToken, boost::intrusive::constant_time_size<false>>;
+
+    // tokens may come from several threads sharing one context
+    std::mutex _mutex;
+    std::condition_variable _cnd;
+    TokenList _tokens;
+    bool _stopping = false;
+    bool _forced = false;
+
+    // the pass in progress and the token it is stopping
+    bool _in_stop = false;
+    std::thread::id _stop_thread;
+    StopToken* _running = nullptr;
+    bool _running_removed = false;
 };
 
 template<typename T>
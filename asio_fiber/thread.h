@@ -1,21 +1,101 @@
 #pragma once
 
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <random>
 #include <type_traits>
 #include <vector>
 #include <thread>
 
+#include "boost/asio/associated_cancellation_slot.hpp"
+#include "boost/asio/async_result.hpp"
+#include "boost/asio/error.hpp"
 #include "boost/asio/executor_work_guard.hpp"
+#include "boost/asio/post.hpp"
+#include "boost/asio/steady_timer.hpp"
+#include "boost/context/detail/exception.hpp"
+#include "boost/fiber/condition_variable.hpp"
+#include "boost/fiber/fiber.hpp"
 #include "boost/fiber/operations.hpp"
+#include "boost/optional.hpp"
+#include "boost/system/result.hpp"
 
 #include "asio_fiber/algo.h"
+#include "asio_fiber/deadline.h"
+#include "asio_fiber/log.h"
+#include "asio_fiber/placement.h"
+#include "asio_fiber/priority.h"
+#include "asio_fiber/shared.h"
+#include "asio_fiber/stack.h"
+#include "asio_fiber/steal.h"
+#include "asio_fiber/stop_scope.h"
 #include "asio_fiber/stop_token.h"
 
 namespace asio_fiber
 {
 
+namespace detail
+{
+// wakes ThreadContext::wait_drained once the last spawned fiber of a draining context ends.
+// a std::mutex, so that the stop handler may signal it from outside of any fiber
+struct DrainState
+{
+    std::atomic<bool> draining{ false };
+    std::mutex mutex;
+    boost::fibers::condition_variable_any cnd;
+
+    void notify()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        cnd.notify_all();
+    }
+};
+
+// keeps AlgorithmStats::fibers counted while a spawned fiber is alive
+template<typename F>
+class CountedCall
+{
+public:
+    template<typename T>
+    CountedCall(T&& f, AlgorithmStats* stats, DrainState* drain) : _f(std::forward<T>(f)), _stats(stats), _drain(drain)
+    {
+        AlgorithmStats::add(_stats->fibers, 1);
+    }
+
+    template<typename ... Args>
+    void operator()(Args&& ... args)
+    {
+        struct Done
+        {
+            AlgorithmStats* stats;
+            DrainState* drain;
+
+            ~Done()
+            {
+                if (1 == stats->fibers.fetch_sub(1, std::memory_order_acq_rel) && drain->draining.load())
+                {
+                    drain->notify();
+                }
+            }
+        } done{ _stats, _drain };
+
+        _f(std::forward<Args>(args)...);
+    }
+private:
+    F _f;
+    AlgorithmStats* _stats;
+    DrainState* _drain;
+};
+}
+
 class ThreadContext : public boost::asio::io_context
 {
 public:
+    using AlgorithmFactory = std::function<boost::fibers::algo::algorithm*(const std::shared_ptr<ThreadContext>&)>;
+
     template<typename C = ThreadContext>
     static typename std::enable_if<std::is_base_of<ThreadContext, C>::value, C *>::type
     current() noexcept
@@ -23,23 +103,129 @@ public:
         return static_cast<C *>(get_instance());
     }
 
-    void stop()
+    // FORCE cancels every Object at once. SMOOTH is a graceful drain: Objects outside of a busy
+    // section, acceptors and idle connections among them, are stopped now, busy ones when the
+    // section ends, and whatever is left is forced once drain has passed
+    void stop(StopMode mode = StopMode::FORCE, std::chrono::steady_clock::duration drain = std::chrono::seconds(30))
+    {
+        // at once from a fiber of this context, so that a drain has begun by the time its
+        // ThreadGuard waits for it
+        if (get_instance() == this)
+        {
+            do_stop(mode, drain);
+            return;
+        }
+
+        this->dispatch([this, mode, drain] { do_stop(mode, drain); });
+    }
+
+    // a stop has begun, long running loops should end at their next boundary
+    bool stopping() const noexcept { return _stopping.load(std::memory_order_acquire); }
+
+    // must be set before the context is guarded, default is Algorithm
+    void set_algorithm(AlgorithmFactory factory) { _algo_factory = std::move(factory); }
+
+    // must be set before the context is guarded, default never spins and runs one handler per wake.
+    // ignored once a thread runs the context, e.g. the shared context of Scheduling::SHARED
+    void set_poll_policy(const PollPolicy& policy)
     {
-        this->dispatch([this] { do_stop(); });
+        if (_guards.load() > 0)
+        {
+            ASIO_FIBER_LOG(WARN, "poll policy of a running context left unchanged");
+            return;
+        }
+
+        _poll_policy = policy;
+    }
+
+    const PollPolicy& get_poll_policy() const noexcept { return _poll_policy; }
+
+    AlgorithmStats& get_stats() noexcept { return _stats; }
+    const AlgorithmStats& get_stats() const noexcept { return _stats; }
+
+    // must be set before the first spawn
+    void set_stack_pool_options(const StackPoolOptions& options) { _stack_pool = std::make_shared<StackPool>(options); }
+    const std::shared_ptr<StackPool>& get_stack_pool() const noexcept { return _stack_pool; }
+
+    // launch a fiber whose stack comes from the pool of this context, it inherits the
+    // DeadlineScope and StopScope of the calling fiber and counts in AlgorithmStats::fibers
+    template<typename F, typename ... Args>
+    boost::fibers::fiber spawn(F&& f, Args&& ... args)
+    {
+        using Counted = detail::CountedCall<typename std::decay<F>::type>;
+        using Scoped = detail::ScopedCall<Counted>;
+        using Call = detail::DeadlineCall<Scoped>;
+
+        return boost::fibers::fiber(std::allocator_arg, PooledStack(_stack_pool),
+            Call(Scoped(Counted(std::forward<F>(f), &_stats, &_drain), StopScope::current()), DeadlineScope::current()),
+            std::forward<Args>(args)...);
     }
 private:
     template<typename C>
     friend class ThreadGuard;
 
-    void use_in_guard() { get_instance() = this; }
+    void use_in_guard(const std::shared_ptr<ThreadContext>& self)
+    {
+        if (_algo_factory)
+        {
+            boost::fibers::context::active()->get_scheduler()->set_algo(_algo_factory(self));
+        }
+        else
+        {
+            boost::fibers::use_scheduling_algorithm<Algorithm>(self, _poll_policy, &_stats);
+        }
+
+        get_instance() = this;
+        StopScope::thread_source() = &_stop_source;
+        _guards.fetch_add(1);
+    }
+
+    // true for the last of the threads running this context
+    bool leave_guard() noexcept { return 1 == _guards.fetch_sub(1); }
 
     template<typename C>
     friend class Object;
 
-    void do_stop()
+    void do_stop(StopMode mode, std::chrono::steady_clock::duration drain)
+    {
+        if (StopMode::SMOOTH == mode)
+        {
+            if (_stopping.exchange(true))
+            {
+                return;
+            }
+
+            _drain.draining.store(true);
+            _stop_source.stop(StopMode::SMOOTH);
+
+            // also keeps the loop from running out of work while the drain lasts
+            _drain_timer.expires_after(drain);
+            _drain_timer.async_wait([this](const boost::system::error_code& ec) {
+                if (!ec)
+                {
+                    ASIO_FIBER_LOG(WARN, "drain deadline passed, forcing stop");
+                    do_stop(StopMode::FORCE, {});
+                }
+            });
+            return;
+        }
+
+        _stopping.store(true);
+        _drain.draining.store(false);
+        _drain.notify();
+        _drain_timer.cancel();
+        _stop_source.stop(StopMode::FORCE);
+
+        // behind the completions the cancellation queued, so that fibers waiting on them
+        // see the abort and end instead of being stranded in a stopped loop
+        boost::asio::post(*this, [this] { boost::asio::io_context::stop(); });
+    }
+
+    // a smooth stop lets the fibers spawned on this thread finish before the loop stops
+    void wait_drained()
     {
-        _stop_source.stop();
-        boost::asio::io_context::stop();
+        std::unique_lock<std::mutex> lock(_drain.mutex);
+        _drain.cnd.wait(lock, [this] { return !_drain.draining.load() || 0 == _stats.fibers.load(std::memory_order_acquire); });
     }
 
     static ThreadContext*& get_instance() noexcept
@@ -49,7 +235,303 @@ private:
     }
 
     StopSource _stop_source;
+    boost::asio::steady_timer _drain_timer{ *this };
+    std::atomic<bool> _stopping{ false };
+    detail::DrainState _drain;
+    // threads running this context, more than one under Scheduling::SHARED
+    std::atomic<int> _guards{ 0 };
+    AlgorithmFactory _algo_factory;
+    PollPolicy _poll_policy;
+    AlgorithmStats _stats;
+    std::shared_ptr<StackPool> _stack_pool = std::make_shared<StackPool>();
+};
+
+// the error async_call completes with when f threw, the exception is logged on the target thread
+inline boost::system::error_code make_call_exception_error() noexcept
+{
+    return boost::system::errc::make_error_code(boost::system::errc::state_not_recoverable);
+}
+
+namespace detail
+{
+template<typename F>
+bool run_call(F&& f)
+{
+    try
+    {
+        f();
+        return true;
+    }
+    catch (const boost::context::detail::forced_unwind&)
+    {
+        throw;
+    }
+    catch (const std::exception& e)
+    {
+        ASIO_FIBER_LOG(WARN, "async_call function threw,err=", e.what());
+    }
+    catch (...)
+    {
+        ASIO_FIBER_LOG(WARN, "async_call function threw");
+    }
+
+    return false;
+}
+
+template<typename R>
+struct CallResult
+{
+    // references come back as copies, errors complete with a default constructed value. a result
+    // without a default constructor comes back in a boost::optional, empty on errors
+    using value_type = typename std::decay<R>::type;
+    static_assert(std::is_move_constructible<value_type>::value, "async_call needs a move constructible result");
+
+    using arg_type = typename std::conditional<std::is_default_constructible<value_type>::value,
+        value_type, boost::optional<value_type>>::type;
+    using signature = void(boost::system::error_code, arg_type);
+
+    template<typename F>
+    explicit CallResult(F& f)
+    {
+        auto ok = run_call([&] { value.emplace(f()); });
+        if (!ok)
+        {
+            ec = make_call_exception_error();
+        }
+    }
+
+    template<typename Handler>
+    void complete(Handler& h)
+    {
+        if (ec)
+        {
+            h(ec, arg_type());
+            return;
+        }
+
+        h(boost::system::error_code(), arg_type(std::move(*value)));
+    }
+
+    template<typename Handler>
+    static void abort(Handler& h) { h(boost::asio::error::make_error_code(boost::asio::error::operation_aborted), arg_type()); }
+
+    boost::system::error_code ec;
+    boost::optional<value_type> value;
+};
+
+template<>
+struct CallResult<void>
+{
+    using signature = void(boost::system::error_code);
+
+    template<typename F>
+    explicit CallResult(F& f)
+    {
+        if (!run_call(f))
+        {
+            ec = make_call_exception_error();
+        }
+    }
+
+    template<typename Handler>
+    void complete(Handler& h) { h(ec); }
+
+    template<typename Handler>
+    static void abort(Handler& h) { h(boost::asio::error::make_error_code(boost::asio::error::operation_aborted)); }
+
+    boost::system::error_code ec;
+};
+
+// completed once, by the result, by cancellation or by a forced stop on the thread of the
+// caller, always on that thread. registered with the innermost StopScope of the caller, so
+// that a stopped caller is not left waiting for a result its loop will never deliver
+template<typename Handler, typename R>
+class CallState : public StopToken
+{
+public:
+    explicit CallState(Handler&& h) : _handler(std::move(h)) {}
+
+    Handler& handler() noexcept { return *_handler; }
+
+    // on the thread of the caller, false if it is force stopped already
+    bool link()
+    {
+        _node = StopScope::current();
+        _source = _node ? &_node->source() : StopScope::thread_source();
+        if (_source && !_source->add_token(*this))
+        {
+            _source = nullptr;
+            return false;
+        }
+
+        return true;
+    }
+
+    void complete(CallResult<R>& result)
+    {
+        if (!_handler)
+        {
+            return;
+        }
+
+        unlink();
+
+        auto slot = boost::asio::get_associated_cancellation_slot(*_handler);
+        if (slot.is_connected())
+        {
+            slot.clear();
+        }
+
+        auto h = std::move(*_handler);
+        _handler.reset();
+        result.complete(h);
+    }
+
+    void cancel()
+    {
+        unlink();
+        abort();
+    }
+
+    // a smooth stop lets the call finish
+    bool stop(StopMode mode) override
+    {
+        if (StopMode::FORCE != mode)
+        {
+            return false;
+        }
+
+        // the source unlinks the token itself
+        _source = nullptr;
+        abort();
+        return true;
+    }
+private:
+    void unlink()
+    {
+        if (_source)
+        {
+            _source->remove_token(*this);
+            _source = nullptr;
+        }
+    }
+
+    void abort()
+    {
+        if (!_handler)
+        {
+            return;
+        }
+
+        auto h = std::move(*_handler);
+        _handler.reset();
+        CallResult<R>::abort(h);
+    }
+
+    boost::optional<Handler> _handler;
+    std::shared_ptr<StopNode> _node;
+    StopSource* _source = nullptr;
 };
+}
+
+// runs f in a new fiber on target, then completes token on the thread of the caller,
+// e.g. auto r = async_call(ctx, [&] { return table.size(); }, yield(100ms)).
+// a cancelled or timed out call still runs f to its end, only its result is dropped, and so
+// does a forced stop of the caller. an exception from f completes the call with
+// make_call_exception_error(). a result without a default constructor comes back in a
+// boost::optional. callers without a ThreadContext get their handler run on target
+template<typename F, typename Token>
+auto async_call(ThreadContext& target, F&& f, Token&& token)
+{
+    using Func = typename std::decay<F>::type;
+    using R = decltype(std::declval<Func&>()());
+
+    return boost::asio::async_initiate<Token, typename detail::CallResult<R>::signature>([&target](auto handler, Func f) {
+        using State = detail::CallState<decltype(handler), R>;
+
+        auto origin = ThreadContext::current();
+        auto state = std::make_shared<State>(std::move(handler));
+        if (origin && !state->link())
+        {
+            state->cancel();
+            return;
+        }
+
+        auto slot = boost::asio::get_associated_cancellation_slot(state->handler());
+        if (slot.is_connected())
+        {
+            // weak, the slot may outlive the call and must not keep the handler
+            std::weak_ptr<State> weak = state;
+            slot.assign([weak](boost::asio::cancellation_type) {
+                auto s = weak.lock();
+                if (s)
+                {
+                    s->cancel();
+                }
+            });
+        }
+
+        target.post([&target, origin, state, f = std::move(f)]() mutable {
+            target.spawn([origin, state, f = std::move(f)]() mutable {
+                detail::CallResult<R> result(f);
+
+                if (!origin)
+                {
+                    state->complete(result);
+                    return;
+                }
+
+                // a stopped origin has aborted the call already, its loop never runs this
+                if (origin->stopped())
+                {
+                    return;
+                }
+
+                origin->post([state, result = std::move(result)]() mutable {
+                    state->complete(result);
+                });
+            }).detach();
+        });
+    }, token, std::forward<F>(f));
+}
+
+// moves an accepted socket to target, where f(socket) runs in a new fiber.
+// the native handle is released here and assigned to a socket of target,
+// on failure socket keeps it. not supported by IOCP before Windows 8.1
+template<typename Socket, typename F>
+boost::system::result<void> post_socket(ThreadContext& target, Socket&& socket, F&& f)
+{
+    using SocketType = typename std::decay<Socket>::type;
+
+    boost::system::error_code ec;
+    auto protocol = socket.local_endpoint(ec).protocol();
+    if (ec)
+    {
+        return ec;
+    }
+
+    auto handle = socket.release(ec);
+    if (ec)
+    {
+        return ec;
+    }
+
+    // registering with the reactor of target is thread safe, the socket is only used there from now on
+    SocketType moved(target);
+    moved.assign(protocol, handle, ec);
+    if (ec)
+    {
+        boost::system::error_code ignored;
+        socket.assign(protocol, handle, ignored);
+        return ec;
+    }
+
+    boost::asio::post(target, [&target, moved = std::move(moved), f = std::forward<F>(f)]() mutable {
+        target.spawn(std::move(f), std::move(moved)).detach();
+    });
+
+    return {};
+}
 
 template<typename C = ThreadContext>
 class ThreadGuard
@@ -57,13 +539,21 @@ class ThreadGuard
 public:
     ThreadGuard() : ThreadGuard(std::make_shared<C>()) {}
 
-    explicit ThreadGuard(const std::shared_ptr<C>& ctx) noexcept : _ctx(ctx)
+    explicit ThreadGuard(const std::shared_ptr<C>& ctx) : _ctx(ctx)
     {
-        boost::fibers::use_scheduling_algorithm<Algorithm>(_ctx);
-        _ctx->use_in_guard();
+        _ctx->use_in_guard(_ctx);
+        Logger::prepare_thread();
     }
 
-    ~ThreadGuard() { _ctx->stop(); }
+    // the last thread to leave a context shared by several stops it
+    ~ThreadGuard()
+    {
+        if (_ctx->leave_guard())
+        {
+            _ctx->wait_drained();
+            _ctx->stop();
+        }
+    }
 
     template<typename F, typename ... Args>
     auto operator()(F&& f, Args&& ... args)
@@ -101,7 +591,11 @@ class Thread
 public:
     Thread(): _ctx(std::make_shared<C>()) {}
 
-    template<typename F>
+    // several threads may run the same context, see Scheduling::SHARED
+    explicit Thread(const std::shared_ptr<C>& ctx) noexcept : _ctx(ctx) {}
+
+    template<typename F, typename = typename std::enable_if<
+        !std::is_same<typename std::decay<F>::type, std::shared_ptr<C>>::value>::type>
     Thread(F&& f) : Thread()
     {
         start(std::forward<F>(f));
@@ -117,6 +611,13 @@ public:
 
             void operator()()
             {
+                // before the guard, so that whatever the context allocates on this thread is node local
+                auto ec = this->owner->_placement.apply(this->owner->_placement_index);
+                if (ec)
+                {
+                    ASIO_FIBER_LOG(WARN, "thread placement failed,err=", ec.message());
+                }
+
                 ThreadGuard<C> guard(this->owner->_ctx);
                 guard(std::move(this->f));
             }
@@ -125,10 +626,22 @@ public:
         _impl = std::thread(Wrap{ std::forward<F>(f), this });
     }
 
-    void stop()
+    // must be set before start, index picks the cpu of one-per-thread placements
+    void set_placement(const Placement& placement, size_t index = 0)
     {
-        _ctx->stop();
+        _placement = placement;
+        _placement_index = index;
+    }
 
+    // returns once the thread has ended, after the drain for StopMode::SMOOTH
+    void stop(StopMode mode = StopMode::FORCE, std::chrono::steady_clock::duration drain = std::chrono::seconds(30))
+    {
+        _ctx->stop(mode, drain);
+        join();
+    }
+
+    void join()
+    {
         if (_impl.joinable())
         {
             _impl.join();
@@ -147,21 +660,101 @@ public:
         _ctx->dispatch(std::forward<F>(f));
     }
 
+    // f runs in a new fiber on this thread and its result comes back to the caller, see async_call
+    template<typename F, typename Token>
+    auto call(F&& f, Token&& token)
+    {
+        return async_call(*_ctx, std::forward<F>(f), std::forward<Token>(token));
+    }
+
+    const std::shared_ptr<C>& get_ctx() const noexcept { return _ctx; }
 private:
     std::shared_ptr<C> _ctx;
+    Placement _placement;
+    size_t _placement_index = 0;
     std::thread _impl;
 };
 
+// how ThreadGroup picks the thread for post_one and post_socket
+enum class Dispatch
+{
+    // each thread in turn
+    ROUND_ROBIN,
+    // the less loaded of two random threads, close to LEAST_LOADED at the cost of two reads
+    TWO_CHOICES,
+    // the least loaded of all threads
+    LEAST_LOADED
+};
+
+enum class Scheduling
+{
+    // fibers never leave the thread which created them
+    LOCAL,
+    // idle threads steal ready fibers from busy ones, see pin_this_fiber
+    WORK_STEALING,
+    // all threads run one shared context and one ready queue, see pin_this_fiber
+    SHARED,
+    // like LOCAL, with a ready queue per FiberPriority, see set_this_fiber_priority
+    PRIORITY
+};
+
 template<typename C = ThreadContext>
 class ThreadGroup
 {
 public:
+    explicit ThreadGroup(Scheduling scheduling = Scheduling::LOCAL) : _scheduling(scheduling)
+    {
+        if (Scheduling::WORK_STEALING == _scheduling)
+        {
+            _steal_group = std::make_shared<StealGroup>();
+        }
+        else if (Scheduling::SHARED == _scheduling)
+        {
+            _shared_ctx = std::make_shared<C>();
+
+            auto group = std::make_shared<SharedGroup>(*_shared_ctx);
+            _shared_ctx->set_algorithm([group](const std::shared_ptr<ThreadContext>& ctx) {
+                return new SharedAlgorithm(ctx, group, ctx->get_poll_policy(), &ctx->get_stats());
+            });
+        }
+    }
+
     ~ThreadGroup() { stop_all(); }
 
     template<typename F>
     void add_thread(F&& f)
     {
-        std::unique_ptr<Thread<C>> ptr(new Thread<C>(std::forward<F>(f)));
+        std::unique_ptr<Thread<C>> ptr(_shared_ctx ? new Thread<C>(_shared_ctx) : new Thread<C>());
+        // the shared context is configured once, before its first thread runs it
+        if (!_shared_ctx || _threads.empty())
+        {
+            ptr->get_ctx()->set_poll_policy(_poll_policy);
+            ptr->get_ctx()->set_stack_pool_options(_stack_pool_options);
+        }
+
+        if (_steal_group)
+        {
+            auto group = _steal_group;
+            ptr->get_ctx()->set_algorithm([group](const std::shared_ptr<ThreadContext>& ctx) {
+                return new StealingAlgorithm(ctx, group, ctx->get_poll_policy(), &ctx->get_stats());
+            });
+        }
+        else if (Scheduling::PRIORITY == _scheduling)
+        {
+            auto weights = _priority_weights;
+            ptr->get_ctx()->set_algorithm([weights](const std::shared_ptr<ThreadContext>& ctx) {
+                return new PriorityAlgorithm(ctx, ctx->get_poll_policy(), &ctx->get_stats(), weights);
+            });
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            ptr->set_placement(_placement, _threads.size());
+        }
+
+        ptr->start(std::forward<F>(f));
+
+        std::lock_guard<std::mutex> lock(_mutex);
         _threads.emplace_back(std::move(ptr));
     }
 
@@ -174,26 +767,203 @@ public:
         }
     }
 
-    void stop_all()
+    // e.g. add_threads(n, f, Placement::spread_cores()), the placement also applies to threads added later
+    template<typename F>
+    void add_threads(size_t n, F f, const Placement& placement)
+    {
+        set_placement(placement);
+        add_threads(n, std::move(f));
+    }
+
+    // applies to threads added later, for Scheduling::SHARED only before the first one
+    void set_poll_policy(const PollPolicy& policy) noexcept { _poll_policy = policy; }
+    void set_stack_pool_options(const StackPoolOptions& options) noexcept { _stack_pool_options = options; }
+    // only used by Scheduling::PRIORITY
+    void set_priority_weights(const PriorityWeights& weights) noexcept { _priority_weights = weights; }
+    // threads count from 0 in order of adding, for one-per-thread placements
+    void set_placement(const Placement& placement) { _placement = placement; }
+
+    // all threads drain at the same time, see ThreadContext::stop
+    void stop_all(StopMode mode = StopMode::FORCE, std::chrono::steady_clock::duration drain = std::chrono::seconds(30))
     {
         for (auto&& thread : _threads)
         {
-            thread->stop();
+            thread->get_ctx()->stop(mode, drain);
+        }
+
+        for (auto&& thread : _threads)
+        {
+            thread->join();
         }
 
+        std::lock_guard<std::mutex> lock(_mutex);
         _threads.clear();
     }
 
+    // one entry per thread, or a single one for Scheduling::SHARED, may be called from any thread
+    std::vector<AlgorithmStatsSnapshot> get_stats() const
+    {
+        std::vector<AlgorithmStatsSnapshot> stats;
+
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_shared_ctx)
+        {
+            stats.push_back(_shared_ctx->get_stats().snapshot());
+            return stats;
+        }
+
+        for (auto&& thread : _threads)
+        {
+            stats.push_back(thread->get_ctx()->get_stats().snapshot());
+        }
+
+        return stats;
+    }
+
+    AlgorithmStatsSnapshot get_total_stats() const
+    {
+        AlgorithmStatsSnapshot total;
+        for (auto&& s : get_stats())
+        {
+            total += s;
+        }
+
+        return total;
+    }
+
+    // once per thread, or once for Scheduling::SHARED where all threads run the same context
     template<typename F>
     void post(F f)
     {
+        if (_shared_ctx)
+        {
+            _shared_ctx->post(std::move(f));
+            return;
+        }
+
         for (auto&& thread : _threads)
         {
             thread->post(f);
         }
     }
+
+    size_t size() const
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _threads.size();
+    }
+
+    // index of the thread new work should go to, load is AlgorithmStatsSnapshot::load
+    size_t pick(Dispatch dispatch = Dispatch::TWO_CHOICES)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return pick_locked(dispatch);
+    }
+
+    // posts f to one thread only, returns its index
+    template<typename F>
+    size_t post_one(F&& f, Dispatch dispatch = Dispatch::TWO_CHOICES)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        auto index = pick_locked(dispatch);
+        _threads[index]->post(std::forward<F>(f));
+        return index;
+    }
+
+    // hands an accepted socket to one thread, see asio_fiber::post_socket, returns its index
+    template<typename Socket, typename F>
+    boost::system::result<size_t> post_socket(Socket&& socket, F&& f, Dispatch dispatch = Dispatch::TWO_CHOICES)
+    {
+        std::shared_ptr<C> ctx;
+        size_t index;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            index = pick_locked(dispatch);
+            ctx = _threads[index]->get_ctx();
+        }
+
+        auto r = asio_fiber::post_socket(*ctx, std::forward<Socket>(socket), std::forward<F>(f));
+        if (!r)
+        {
+            return r.error();
+        }
+
+        return index;
+    }
+
+    // f runs on the index-th thread added, e.g. the owner of a shard, see async_call
+    template<typename F, typename Token>
+    auto call(size_t index, F&& f, Token&& token)
+    {
+        std::shared_ptr<C> ctx;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            BOOST_ASSERT(index < _threads.size());
+            ctx = _threads[index]->get_ctx();
+        }
+
+        return async_call(*ctx, std::forward<F>(f), std::forward<Token>(token));
+    }
 private:
+    static uint64_t load_of(const Thread<C>& thread) noexcept
+    {
+        auto& stats = thread.get_ctx()->get_stats();
+        return stats.ready.load(std::memory_order_relaxed) + stats.fibers.load(std::memory_order_relaxed);
+    }
+
+    size_t pick_locked(Dispatch dispatch)
+    {
+        BOOST_ASSERT(!_threads.empty());
+
+        auto n = _threads.size();
+        if (1 == n || _shared_ctx)
+        {
+            return 0;
+        }
+
+        if (Dispatch::ROUND_ROBIN == dispatch)
+        {
+            return _next++ % n;
+        }
+
+        if (Dispatch::TWO_CHOICES == dispatch)
+        {
+            auto a = _rand() % n;
+            auto b = (a + 1 + _rand() % (n - 1)) % n;
+            return load_of(*_threads[b]) < load_of(*_threads[a]) ? b : a;
+        }
+
+        // ties go round robin, so an idle group is still spread evenly
+        auto start = _next++ % n;
+        auto best = start;
+        auto best_load = load_of(*_threads[best]);
+        for (size_t i = 1; i < n && best_load > 0; ++i)
+        {
+            auto index = (start + i) % n;
+            auto load = load_of(*_threads[index]);
+            if (load < best_load)
+            {
+                best = index;
+                best_load = load;
+            }
+        }
+
+        return best;
+    }
+
+    Scheduling _scheduling;
+    std::shared_ptr<StealGroup> _steal_group;
+    std::shared_ptr<C> _shared_ctx;
+    PollPolicy _poll_policy;
+    StackPoolOptions _stack_pool_options;
+    PriorityWeights _priority_weights;
+    Placement _placement;
+    // guards _threads, _next and _rand against callers on other threads
+    mutable std::mutex _mutex;
     std::vector<std::unique_ptr<Thread<C>>> _threads;
+    size_t _next = 0;
+    std::minstd_rand _rand;
 };
 
 }
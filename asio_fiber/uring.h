@@ -0,0 +1,203 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "boost/asio/buffer.hpp"
+#include "boost/asio/io_context.hpp"
+#include "boost/asio/version.hpp"
+#include "boost/system/result.hpp"
+#include "boost/assert.hpp"
+
+// buffer registration is new in Boost 1.80
+#if BOOST_ASIO_VERSION >= 102400
+    #include "boost/asio/buffer_registration.hpp"
+    #include "boost/asio/registered_buffer.hpp"
+#endif
+
+#if defined(BOOST_ASIO_HAS_FILE)
+    #include "boost/asio/random_access_file.hpp"
+    #include "boost/asio/read_at.hpp"
+    #include "boost/asio/write_at.hpp"
+#endif
+
+#include "asio_fiber/yield.h"
+
+namespace asio_fiber
+{
+
+// reactor asio was built with, the backend is chosen at compile time, see ASIO_FIBER_IO_URING in CMakeLists.txt
+constexpr const char* io_backend_name() noexcept
+{
+#if defined(BOOST_ASIO_HAS_IO_URING_AS_DEFAULT)
+    return "io_uring";
+#elif defined(BOOST_ASIO_HAS_IOCP)
+    return "iocp";
+#elif defined(BOOST_ASIO_HAS_EPOLL)
+    return "epoll";
+#elif defined(BOOST_ASIO_HAS_KQUEUE)
+    return "kqueue";
+#else
+    return "select";
+#endif
+}
+
+#if BOOST_ASIO_VERSION >= 102400
+// fixed size buffers registered once with an io_context, so io_uring reads and writes
+// into them skip pinning pages per operation. other backends use them as plain buffers.
+// io_uring accepts one registration per ring, so keep one pool per ThreadContext
+class RegisteredBufferPool
+{
+public:
+    using Registration = boost::asio::buffer_registration<std::vector<boost::asio::mutable_buffer>>;
+
+    // returns its buffer to the pool on destruction
+    class Lease
+    {
+    public:
+        Lease() noexcept = default;
+        Lease(Lease&& other) noexcept : _pool(other._pool), _index(other._index) { other._pool = nullptr; }
+
+        Lease& operator=(Lease&& other) noexcept
+        {
+            if (this != &other)
+            {
+                release();
+                _pool = other._pool;
+                _index = other._index;
+                other._pool = nullptr;
+            }
+
+            return *this;
+        }
+
+        ~Lease() { release(); }
+
+        explicit operator bool() const noexcept { return _pool != nullptr; }
+
+        boost::asio::mutable_registered_buffer buffer() const noexcept
+        {
+            BOOST_ASSERT(_pool != nullptr);
+            return _pool->_registration[_index];
+        }
+
+        void release() noexcept
+        {
+            if (_pool)
+            {
+                _pool->_free.push_back(_index);
+                _pool = nullptr;
+            }
+        }
+    private:
+        friend class RegisteredBufferPool;
+
+        Lease(RegisteredBufferPool* pool, size_t index) noexcept : _pool(pool), _index(index) {}
+
+        Lease(const Lease&) = delete;
+        void operator=(const Lease&) = delete;
+
+        RegisteredBufferPool* _pool = nullptr;
+        size_t _index = 0;
+    };
+
+    RegisteredBufferPool(boost::asio::io_context& io_ctx, size_t count, size_t size)
+        : _storage(count * size)
+        , _buffers(split(_storage, count, size))
+        , _registration(boost::asio::register_buffers(io_ctx, _buffers))
+    {
+        _free.reserve(count);
+        for (size_t i = count; i > 0; --i)
+        {
+            _free.push_back(i - 1);
+        }
+    }
+
+    // empty lease if every buffer is in use
+    Lease acquire() noexcept
+    {
+        if (_free.empty())
+        {
+            return {};
+        }
+
+        auto index = _free.back();
+        _free.pop_back();
+        return Lease(this, index);
+    }
+
+    size_t available() const noexcept { return _free.size(); }
+private:
+    RegisteredBufferPool(const RegisteredBufferPool&) = delete;
+    void operator=(const RegisteredBufferPool&) = delete;
+
+    static std::vector<boost::asio::mutable_buffer> split(std::vector<char>& storage, size_t count, size_t size)
+    {
+        std::vector<boost::asio::mutable_buffer> buffers;
+        buffers.reserve(count);
+        for (size_t i = 0; i < count; ++i)
+        {
+            buffers.emplace_back(storage.data() + i * size, size);
+        }
+
+        return buffers;
+    }
+
+    std::vector<char> _storage;
+    std::vector<boost::asio::mutable_buffer> _buffers;
+    Registration _registration;
+    std::vector<size_t> _free;
+};
+#endif
+
+#if defined(BOOST_ASIO_HAS_FILE)
+// whole file read from a fiber, with io_uring the read never blocks the thread
+inline boost::system::result<std::string> read_file(boost::asio::io_context& io_ctx, const std::string& path)
+{
+    boost::system::error_code ec;
+    boost::asio::random_access_file file(io_ctx);
+    file.open(path, boost::asio::file_base::read_only, ec);
+    if (ec)
+    {
+        return ec;
+    }
+
+    auto size = file.size(ec);
+    if (ec)
+    {
+        return ec;
+    }
+
+    std::string data(static_cast<size_t>(size), '\0');
+    auto r = boost::asio::async_read_at(file, 0, boost::asio::buffer(&data[0], data.size()), yield());
+    if (!r)
+    {
+        return r.error();
+    }
+
+    data.resize(*r);
+    return data;
+}
+
+// replaces the content of path with data
+inline boost::system::result<void> write_file(boost::asio::io_context& io_ctx, const std::string& path, boost::asio::const_buffer data)
+{
+    boost::system::error_code ec;
+    boost::asio::random_access_file file(io_ctx);
+    file.open(path, boost::asio::file_base::write_only | boost::asio::file_base::create | boost::asio::file_base::truncate, ec);
+    if (ec)
+    {
+        return ec;
+    }
+
+    auto r = boost::asio::async_write_at(file, 0, data, yield());
+    if (!r)
+    {
+        return r.error();
+    }
+
+    return {};
+}
+#endif
+
+}
@@ -0,0 +1,281 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+
+#include "boost/intrusive/list.hpp"
+#include "boost/assert.hpp"
+
+namespace asio_fiber
+{
+
+class TimerWheel;
+
+class WheelTimer : public boost::intrusive::list_base_hook<boost::intrusive::link_mode<boost::intrusive::normal_link>>
+{
+public:
+    using Callback = void (*)(void* arg);
+
+    WheelTimer() noexcept = default;
+    ~WheelTimer() { cancel(); }
+
+    bool armed() const noexcept { return _wheel != nullptr; }
+
+    inline void cancel() noexcept;
+private:
+    WheelTimer(const WheelTimer&) = delete;
+    void operator=(const WheelTimer&) = delete;
+
+    friend class TimerWheel;
+
+    TimerWheel* _wheel = nullptr;
+    Callback _callback = nullptr;
+    void* _arg = nullptr;
+    uint64_t _expire_tick = 0;
+    unsigned _level = 0;
+    unsigned _slot = 0;
+};
+
+// hierarchical timing wheel owned by one thread, O(1) arm and cancel.
+// now() is a coarse clock refreshed by update(), so arming never reads the system clock.
+class TimerWheel
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    explicit TimerWheel(Clock::duration tick = std::chrono::milliseconds(1), Clock::time_point now = Clock::now()) noexcept
+        : _tick(tick), _start(now), _now(now) {}
+
+    ~TimerWheel()
+    {
+        for (auto&& level : _slots)
+        {
+            for (auto&& slot : level)
+            {
+                while (!slot.empty())
+                {
+                    auto& timer = slot.front();
+                    slot.pop_front();
+                    timer._wheel = nullptr;
+                }
+            }
+        }
+    }
+
+    // wheel of the running thread, nullptr if its scheduling algorithm has none
+    static TimerWheel*& current() noexcept
+    {
+        static thread_local TimerWheel* s_current = nullptr;
+        return s_current;
+    }
+
+    Clock::time_point now() const noexcept { return _now; }
+    bool empty() const noexcept { return 0 == _count; }
+
+    // fires callback(arg) on the owner thread, no earlier than expire_at
+    void arm(WheelTimer& timer, Clock::time_point expire_at, WheelTimer::Callback callback, void* arg) noexcept
+    {
+        BOOST_ASSERT(!timer.armed());
+
+        timer._wheel = this;
+        timer._callback = callback;
+        timer._arg = arg;
+        timer._expire_tick = expire_at <= _start ? 0 : ceil_tick(expire_at);
+        ++_count;
+
+        link(timer);
+    }
+
+    // advance to now and fire every expired timer
+    void update(Clock::time_point now) noexcept
+    {
+        _now = now;
+
+        auto target = floor_tick(now);
+        if (0 == _count)
+        {
+            _next_tick = (std::max)(_next_tick, target + 1);
+            return;
+        }
+
+        while (_next_tick <= target)
+        {
+            auto index = _next_tick & kMask;
+            if (0 == index)
+            {
+                for (unsigned level = 1; level < kLevels && cascade(level) == 0; ++level) {}
+            }
+
+            if (0 == _bitmap[0])
+            {
+                // nothing to fire before the next cascade
+                _next_tick = (std::min)((_next_tick | kMask) + 1, target + 1);
+                continue;
+            }
+
+            ++_next_tick;
+            fire(index);
+        }
+    }
+
+    // time of the next expiry or cascade, max() if no timer is armed
+    Clock::time_point next_expiry() const noexcept
+    {
+        if (0 == _count)
+        {
+            return (Clock::time_point::max)();
+        }
+
+        auto next = UINT64_MAX;
+        for (unsigned level = 0; level < kLevels; ++level)
+        {
+            if (0 == _bitmap[level])
+            {
+                continue;
+            }
+
+            auto shift = level * kBits;
+            auto first = (_next_tick + (uint64_t(1) << shift) - 1) >> shift;
+            auto rotated = rotate_right(_bitmap[level], first & kMask);
+            auto tick = (first + count_trailing_zeros(rotated)) << shift;
+            next = (std::min)(next, tick);
+        }
+
+        return _start + _tick * next;
+    }
+private:
+    friend class WheelTimer;
+
+    static constexpr unsigned kBits = 6;
+    static constexpr unsigned kLevels = 4;
+    static constexpr uint64_t kSize = uint64_t(1) << kBits;
+    static constexpr uint64_t kMask = kSize - 1;
+
+    using Slot = boost::intrusive::list<WheelTimer, boost::intrusive::constant_time_size<false>>;
+
+    uint64_t floor_tick(Clock::time_point t) const noexcept
+    {
+        return t <= _start ? 0 : static_cast<uint64_t>((t - _start) / _tick);
+    }
+
+    uint64_t ceil_tick(Clock::time_point t) const noexcept
+    {
+        return static_cast<uint64_t>((t - _start + _tick - Clock::duration(1)) / _tick);
+    }
+
+    void link(WheelTimer& timer) noexcept
+    {
+        auto expire = (std::max)(timer._expire_tick, _next_tick);
+        auto delta = expire - _next_tick;
+
+        unsigned level = 0;
+        while (level + 1 < kLevels && delta >= (uint64_t(1) << (kBits * (level + 1))))
+        {
+            ++level;
+        }
+
+        if (delta >= (uint64_t(1) << (kBits * kLevels)))
+        {
+            // re-linked when it cascades down, see fire
+            expire = _next_tick + (uint64_t(1) << (kBits * kLevels)) - 1;
+        }
+
+        timer._level = level;
+        timer._slot = static_cast<unsigned>((expire >> (kBits * level)) & kMask);
+        _slots[level][timer._slot].push_back(timer);
+        _bitmap[level] |= uint64_t(1) << timer._slot;
+    }
+
+    void unlink(WheelTimer& timer) noexcept
+    {
+        auto& slot = _slots[timer._level][timer._slot];
+        slot.erase(slot.iterator_to(timer));
+
+        if (slot.empty())
+        {
+            _bitmap[timer._level] &= ~(uint64_t(1) << timer._slot);
+        }
+    }
+
+    uint64_t cascade(unsigned level) noexcept
+    {
+        auto index = (_next_tick >> (kBits * level)) & kMask;
+        auto& slot = _slots[level][index];
+
+        Slot timers;
+        timers.splice(timers.end(), slot);
+        _bitmap[level] &= ~(uint64_t(1) << index);
+
+        while (!timers.empty())
+        {
+            auto& timer = timers.front();
+            timers.pop_front();
+            link(timer);
+        }
+
+        return index;
+    }
+
+    void fire(uint64_t index) noexcept
+    {
+        Slot timers;
+        timers.splice(timers.end(), _slots[0][index]);
+        _bitmap[0] &= ~(uint64_t(1) << index);
+
+        while (!timers.empty())
+        {
+            auto& timer = timers.front();
+            timers.pop_front();
+
+            if (timer._expire_tick >= _next_tick)
+            {
+                link(timer);
+                continue;
+            }
+
+            --_count;
+            timer._wheel = nullptr;
+            timer._callback(timer._arg);
+        }
+    }
+
+    static uint64_t rotate_right(uint64_t bits, uint64_t n) noexcept
+    {
+        return n == 0 ? bits : (bits >> n) | (bits << (kSize - n));
+    }
+
+    static unsigned count_trailing_zeros(uint64_t bits) noexcept
+    {
+        BOOST_ASSERT(bits != 0);
+
+        unsigned n = 0;
+        while (0 == (bits & 1))
+        {
+            bits >>= 1;
+            ++n;
+        }
+
+        return n;
+    }
+
+    Clock::duration _tick;
+    Clock::time_point _start;
+    Clock::time_point _now;
+    uint64_t _next_tick = 0;
+    size_t _count = 0;
+    uint64_t _bitmap[kLevels] = {};
+    Slot _slots[kLevels][kSize];
+};
+
+inline void WheelTimer::cancel() noexcept
+{
+    if (_wheel)
+    {
+        _wheel->unlink(*this);
+        --_wheel->_count;
+        _wheel = nullptr;
+    }
+}
+
+}
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <algorithm>
 #include <tuple>
 #include <chrono>
 #include <type_traits>
@@ -12,6 +13,11 @@
 #include "boost/optional.hpp"
 #include "boost/assert.hpp"
 
+#include "asio_fiber/arena.h"
+#include "asio_fiber/deadline.h"
+#include "asio_fiber/stop_scope.h"
+#include "asio_fiber/wheel.h"
+
 namespace asio_fiber
 {
 
@@ -23,14 +29,18 @@ public:
     constexpr TimeoutContext(Clock::time_point expire_at = (Clock::time_point::max)()) noexcept
         : _expire_at(expire_at) {}
 
+    // relative, the deadline is fixed when the operation starts waiting
     template<typename Rep, typename Period>
     TimeoutContext(std::chrono::duration<Rep, Period> duration) noexcept
-        : _expire_at(Clock::now() + duration) {}
+        : _timeout(std::chrono::duration_cast<Clock::duration>(duration)), _relative(true) {}
 
-    Clock::time_point expire_at() const noexcept { return _expire_at; }
-    bool has_expired() const noexcept { return _expire_at != (Clock::time_point::max)(); }
+    Clock::time_point expire_at() const noexcept { return _relative ? Clock::now() + _timeout : _expire_at; }
+    Clock::time_point expire_at(Clock::time_point now) const noexcept { return _relative ? now + _timeout : _expire_at; }
+    bool has_expired() const noexcept { return _relative || _expire_at != (Clock::time_point::max)(); }
 private:
-    Clock::time_point _expire_at;
+    Clock::time_point _expire_at = (Clock::time_point::max)();
+    Clock::duration _timeout{ 0 };
+    bool _relative = false;
 };
 
 template<bool Timeout>
@@ -66,18 +76,35 @@ struct YieldReturn<>
     using type = void;
 };
 
-template<bool Timeout>
-class YieldPolicy
+namespace detail
+{
+// arms a deadline for one yield, the tighter of the token timeout and the enclosing DeadlineScope,
+// and ties it to the enclosing StopScope. both cancel the operation through its slot
+class TimeoutPolicy
 {
 public:
+    using Clock = TimeoutContext::Clock;
+
+    ~TimeoutPolicy()
+    {
+        if (_yield_link)
+        {
+            _yield_link->detach();
+        }
+    }
+
     template<typename H>
-    void init(H& h) noexcept
+    void init(H& h, const TimeoutContext& timeout, Clock::time_point limit, YieldLink* link) noexcept
     {
-        auto&& token = h.get_token();
-        if (token.has_expired())
+        _timeout_ctx.emplace(timeout, limit);
+        h.set_slot(_timeout_ctx->slot());
+
+        if (link)
         {
-            _timeout_ctx.emplace(token.expire_at());
-            h.set_slot(_timeout_ctx->slot());
+            _yield_link = link;
+
+            // the scope is cancelled already, so is the operation once it has started
+            _cancel_pending = !link->attach(&*_timeout_ctx);
         }
     }
 
@@ -85,7 +112,35 @@ public:
     {
         if (_timeout_ctx)
         {
-            fctx->wait_until(_timeout_ctx->expire_at());
+            if (_cancel_pending)
+            {
+                _cancel_pending = false;
+                _timeout_ctx->emit(boost::asio::cancellation_type::total);
+
+                if (is_done)
+                {
+                    return true;
+                }
+            }
+
+            if (!_timeout_ctx->bounded())
+            {
+                return false;
+            }
+
+            // O(1) and no clock read if this thread has a timer wheel
+            auto wheel = TimerWheel::current();
+            if (wheel)
+            {
+                if (!_timeout_ctx->armed() && !_is_timeout)
+                {
+                    wheel->arm(*_timeout_ctx, _timeout_ctx->expire_at(wheel->now()), &TimeoutPolicy::on_timeout, this);
+                }
+
+                return false;
+            }
+
+            fctx->wait_until(_timeout_ctx->expire_at(Clock::now()));
 
             if (is_done)
             {
@@ -120,34 +175,73 @@ public:
     }
 
 private:
-    struct TimeoutCtx : boost::asio::cancellation_signal, TimeoutContext
+    // the wheel timer is cancelled on destruction, which happens on the thread owning the wheel
+    struct TimeoutCtx : boost::asio::cancellation_signal, TimeoutContext, WheelTimer
     {
-        using TimeoutContext::TimeoutContext;
+        TimeoutCtx(const TimeoutContext& timeout, Clock::time_point limit) noexcept
+            : TimeoutContext(timeout), _limit(limit) {}
+
+        Clock::time_point expire_at(Clock::time_point now) const noexcept
+        {
+            return (std::min)(TimeoutContext::expire_at(now), _limit);
+        }
+
+        // false when only a StopScope may cancel
+        bool bounded() const noexcept
+        {
+            return has_expired() || _limit != (Clock::time_point::max)();
+        }
+
+        Clock::time_point _limit;
     };
 
+    static void on_timeout(void* arg) noexcept
+    {
+        auto self = static_cast<TimeoutPolicy*>(arg);
+        self->_is_timeout = true;
+        self->_timeout_ctx->emit(boost::asio::cancellation_type::total);
+    }
+
     boost::optional<TimeoutCtx> _timeout_ctx;
+    // a forced stop of the scope cancels the operation, a smooth one lets it finish
+    YieldLink* _yield_link = nullptr;
     bool _is_timeout = false;
+    bool _cancel_pending = false;
 };
+}
 
-template<>
-class YieldPolicy<false>
+template<bool Timeout>
+class YieldPolicy : public detail::TimeoutPolicy
 {
 public:
     template<typename H>
-    void init(H&) noexcept {}
-
-    bool wait(boost::fibers::context* fctx, bool& is_done) noexcept { return false; }
-
-    template<typename Return, typename E, typename ... Args>
-    void on_completion(Return& return_value, E&& ec, Args&& ... args) noexcept
+    void init(H& h) noexcept
     {
-        if (ec)
+        auto&& token = h.get_token();
+        auto frame = detail::ScopeFrame::top();
+        auto limit = frame ? frame->frame_deadline() : (Clock::time_point::max)();
+        auto link = frame ? frame->frame_yield_link() : nullptr;
+        if (token.has_expired() || limit != (Clock::time_point::max)() || link)
         {
-            return_value = Return(std::forward<E>(ec));
+            detail::TimeoutPolicy::init(h, token, limit, link);
         }
-        else
+    }
+};
+
+// plain yield() is only bounded by the enclosing DeadlineScope and StopScope, if any
+template<>
+class YieldPolicy<false> : public detail::TimeoutPolicy
+{
+public:
+    template<typename H>
+    void init(H& h) noexcept
+    {
+        auto frame = detail::ScopeFrame::top();
+        auto limit = frame ? frame->frame_deadline() : (Clock::time_point::max)();
+        auto link = frame ? frame->frame_yield_link() : nullptr;
+        if (limit != (Clock::time_point::max)() || link)
         {
-            return_value = Return(std::forward<Args>(args)...);
+            detail::TimeoutPolicy::init(h, TimeoutContext(limit), limit, link);
         }
     }
 };
@@ -168,6 +262,7 @@ public:
     {
     public:
         using cancellation_slot_type = boost::asio::cancellation_slot;
+        using allocator_type = asio_fiber::YieldAllocator<void>;
 
         template<typename T>
         explicit completion_handler_type(T&& token) noexcept : _token(std::forward<T>(token)) {}
@@ -183,6 +278,7 @@ public:
 
         const asio_fiber::YieldContext<Timeout>& get_token() const noexcept { return _token; }
         cancellation_slot_type get_cancellation_slot() const noexcept { return _slot; }
+        allocator_type get_allocator() const noexcept { return {}; }
     private:
         asio_fiber::YieldContext<Timeout> _token;
         async_result* _result = nullptr;
@@ -0,0 +1,500 @@
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <thread>
+
+#include "boost/asio.hpp"
+#include "boost/asio/coroutine.hpp"
+#include "boost/fiber/buffered_channel.hpp"
+#include "boost/fiber/future.hpp"
+#include "boost/program_options.hpp"
+
+#include "asio_fiber/yield.h"
+#include "asio_fiber/thread.h"
+
+namespace fibers = boost::fibers;
+namespace net = boost::asio;
+
+using Clock = std::chrono::steady_clock;
+
+struct Options
+{
+    size_t iterations = 1000000;
+    std::string filter;
+
+    bool parse(int argc, const char *argv[])
+    {
+        namespace po = boost::program_options;
+
+        po::options_description desc("asio_fiber microbenchmarks, one json object per line on stdout");
+        desc.add_options()
+            ("help,H", "print help info")
+            ("iterations,N", po::value(&iterations)->default_value(1000000), "iterations of the cheapest cases, others run a fraction")
+            ("filter,F", po::value(&filter), "only run cases whose name contains it");
+
+        po::variables_map vars;
+        try
+        {
+            po::store(po::parse_command_line(argc, argv, desc), vars);
+        }
+        catch (const std::exception& e)
+        {
+            std::cerr << "parse opts failed,err=" << e.what() << std::endl;
+            return false;
+        }
+
+        vars.notify();
+
+        if (vars.count("help"))
+        {
+            desc.print(std::clog, 4);
+            return false;
+        }
+
+        return true;
+    }
+} g_opts;
+
+bool selected(const char* name)
+{
+    return g_opts.filter.empty() || std::string(name).find(g_opts.filter) != std::string::npos;
+}
+
+void report(const char* name, const char* impl, size_t n, Clock::duration elapsed)
+{
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+    std::printf("{\"case\":\"%s\",\"impl\":\"%s\",\"iterations\":%zu,\"total_ns\":%lld,\"ns_per_op\":%.1f,\"ops_per_sec\":%.0f}\n",
+        name, impl, n, static_cast<long long>(ns), double(ns) / n, n * 1e9 / (ns > 0 ? ns : 1));
+    std::fflush(stdout);
+}
+
+// completes through the io_context right away, isolates the cost of suspending and resuming
+template<typename Token>
+auto async_ready(net::io_context& io_ctx, Token&& token)
+{
+    return net::async_initiate<Token, void(boost::system::error_code)>([&io_ctx](auto handler) {
+        net::post(io_ctx, [handler = std::move(handler)]() mutable {
+            handler(boost::system::error_code());
+        });
+    }, token);
+}
+
+struct ReadyOp
+{
+    static const char* name() noexcept { return "yield_ready"; }
+    static size_t divisor() noexcept { return 1; }
+
+    net::io_context& io_ctx;
+
+    template<typename Token>
+    auto operator()(Token&& token) { return async_ready(io_ctx, std::forward<Token>(token)); }
+};
+
+// expires at once, adds the timer queue and a reactor round trip
+struct TimerOp
+{
+    static const char* name() noexcept { return "yield_timer"; }
+    static size_t divisor() noexcept { return 10; }
+
+    net::steady_timer& timer;
+
+    template<typename Token>
+    auto operator()(Token&& token)
+    {
+        timer.expires_after(Clock::duration::zero());
+        return timer.async_wait(std::forward<Token>(token));
+    }
+};
+
+// state shared by the callback and coroutine loops, they stop after n completions
+struct LoopState
+{
+    size_t i = 0;
+    size_t n = 0;
+    fibers::promise<void> done;
+};
+
+template<typename Op>
+struct CallbackLoop
+{
+    Op op;
+    LoopState* state;
+
+    void operator()(boost::system::error_code)
+    {
+        if (++state->i < state->n)
+        {
+            op(std::move(*this));
+        }
+        else
+        {
+            state->done.set_value();
+        }
+    }
+};
+
+template<typename Op>
+struct CoroutineLoop : net::coroutine
+{
+    Op op;
+    LoopState* state;
+
+    CoroutineLoop(Op op, LoopState* state) : op(op), state(state) {}
+
+    void operator()(boost::system::error_code = {})
+    {
+        BOOST_ASIO_CORO_REENTER(this)
+        {
+            for (state->i = 0; state->i < state->n; ++state->i)
+            {
+                BOOST_ASIO_CORO_YIELD op(std::move(*this));
+            }
+
+            state->done.set_value();
+        }
+    }
+};
+
+// runs a loop started by start, the calling fiber waits so the scheduler keeps driving the same io_context
+template<typename F>
+Clock::duration wait_loop(LoopState& state, F&& start)
+{
+    auto done = state.done.get_future();
+    auto begin = Clock::now();
+    start();
+    done.get();
+    return Clock::now() - begin;
+}
+
+template<typename Op>
+void bench_op(Op op)
+{
+    if (!selected(Op::name()))
+    {
+        return;
+    }
+
+    auto n = g_opts.iterations / Op::divisor();
+
+    auto begin = Clock::now();
+    for (size_t i = 0; i < n; ++i)
+    {
+        op(asio_fiber::yield());
+    }
+    report(Op::name(), "fiber", n, Clock::now() - begin);
+
+    LoopState callback;
+    callback.n = n;
+    report(Op::name(), "callback", n, wait_loop(callback, [&] { op(CallbackLoop<Op>{ op, &callback }); }));
+
+    LoopState coroutine;
+    coroutine.n = n;
+    report(Op::name(), "coroutine", n, wait_loop(coroutine, [&] { CoroutineLoop<Op>(op, &coroutine)(); }));
+}
+
+// yield(timeout) against yield() on the same op, the callback forms arm and cancel a steady_timer
+struct TimeoutOp
+{
+    net::io_context& io_ctx;
+    net::steady_timer& guard;
+
+    template<typename Handler>
+    void operator()(Handler&& handler)
+    {
+        guard.expires_after(std::chrono::seconds(1));
+        guard.async_wait([](boost::system::error_code) {});
+
+        // not this, the op is moved into the handler and gone by the time the completion runs
+        async_ready(io_ctx, [&guard = guard, handler = std::move(handler)](boost::system::error_code ec) mutable {
+            guard.cancel();
+            handler(ec);
+        });
+    }
+};
+
+void bench_timeout(asio_fiber::ThreadContext& ctx)
+{
+    static const char* name = "yield_timeout";
+    if (!selected(name))
+    {
+        return;
+    }
+
+    auto n = g_opts.iterations;
+
+    auto begin = Clock::now();
+    for (size_t i = 0; i < n; ++i)
+    {
+        async_ready(ctx, asio_fiber::yield(std::chrono::seconds(1)));
+    }
+    report(name, "fiber", n, Clock::now() - begin);
+
+    net::steady_timer guard(ctx);
+    TimeoutOp op{ ctx, guard };
+
+    LoopState callback;
+    callback.n = n;
+    report(name, "callback", n, wait_loop(callback, [&] { op(CallbackLoop<TimeoutOp>{ op, &callback }); }));
+
+    LoopState coroutine;
+    coroutine.n = n;
+    report(name, "coroutine", n, wait_loop(coroutine, [&] { CoroutineLoop<TimeoutOp>(op, &coroutine)(); }));
+}
+
+// a task that does nothing, started and awaited n times
+void bench_spawn(asio_fiber::ThreadContext& ctx)
+{
+    static const char* name = "spawn_join";
+    if (!selected(name))
+    {
+        return;
+    }
+
+    auto n = g_opts.iterations / 10;
+    size_t runs = 0;
+
+    auto begin = Clock::now();
+    for (size_t i = 0; i < n; ++i)
+    {
+        fibers::fiber([&runs] { ++runs; }).join();
+    }
+    report(name, "fiber", n, Clock::now() - begin);
+
+    begin = Clock::now();
+    for (size_t i = 0; i < n; ++i)
+    {
+        ctx.spawn([&runs] { ++runs; }).join();
+    }
+    report(name, "fiber_pooled_stack", n, Clock::now() - begin);
+
+    // posting the task and resuming on its completion is the callback analogue of spawn and join.
+    // a stackless coroutine runs the same way, so it has no separate row
+    struct Task
+    {
+        LoopState* state;
+        net::io_context* io_ctx;
+
+        void operator()()
+        {
+            if (++state->i < state->n)
+            {
+                net::post(*io_ctx, *this);
+            }
+            else
+            {
+                state->done.set_value();
+            }
+        }
+    };
+
+    LoopState callback;
+    callback.n = n;
+    report(name, "callback", n, wait_loop(callback, [&] { net::post(ctx, Task{ &callback, &ctx }); }));
+}
+
+// a peer thread whose scheduler keeps polling its context until close
+class Peer
+{
+public:
+    Peer()
+    {
+        auto closed = _closed.get_future().share();
+        _thread.start([closed](asio_fiber::ThreadContext&) { closed.get(); });
+    }
+
+    ~Peer() { close(); }
+
+    void close()
+    {
+        if (!_is_closed)
+        {
+            _is_closed = true;
+            _closed.set_value();
+            _thread.stop();
+        }
+    }
+
+    asio_fiber::ThreadContext& ctx() noexcept { return *_thread.get_ctx(); }
+
+    template<typename F>
+    void post(F&& f) { _thread.post(std::forward<F>(f)); }
+private:
+    fibers::promise<void> _closed;
+    bool _is_closed = false;
+    asio_fiber::Thread<> _thread;
+};
+
+// round trips between two threads, every hop wakes a sleeping scheduler through Algorithm::notify
+void bench_notify(asio_fiber::ThreadContext& ctx)
+{
+    static const char* name = "cross_thread_notify";
+    if (!selected(name))
+    {
+        return;
+    }
+
+    auto n = g_opts.iterations / 10;
+
+    {
+        fibers::buffered_channel<size_t> ping(2);
+        fibers::buffered_channel<size_t> pong(2);
+
+        asio_fiber::Thread<> peer([&](asio_fiber::ThreadContext&) {
+            size_t v;
+            while (fibers::channel_op_status::success == ping.pop(v))
+            {
+                pong.push(v);
+            }
+        });
+
+        auto begin = Clock::now();
+        for (size_t i = 0; i < n; ++i)
+        {
+            size_t v;
+            ping.push(i);
+            pong.pop(v);
+        }
+        report(name, "fiber", n, Clock::now() - begin);
+
+        ping.close();
+        peer.stop();
+    }
+
+    Peer peer;
+
+    struct Bounce
+    {
+        LoopState* state;
+        net::io_context* home;
+        net::io_context* away;
+        bool at_home = true;
+
+        void operator()()
+        {
+            if (at_home && ++state->i > state->n)
+            {
+                state->done.set_value();
+                return;
+            }
+
+            at_home = !at_home;
+            net::post(at_home ? *home : *away, *this);
+        }
+    };
+
+    LoopState callback;
+    callback.n = n;
+    report(name, "callback", n, wait_loop(callback, [&] { net::post(ctx, Bounce{ &callback, &ctx, &peer.ctx() }); }));
+
+    struct Coroutine : net::coroutine
+    {
+        LoopState* state;
+        net::io_context* home;
+        net::io_context* away;
+
+        Coroutine(LoopState* state, net::io_context* home, net::io_context* away) : state(state), home(home), away(away) {}
+
+        void operator()()
+        {
+            BOOST_ASIO_CORO_REENTER(this)
+            {
+                for (state->i = 0; state->i < state->n; ++state->i)
+                {
+                    BOOST_ASIO_CORO_YIELD net::post(*away, *this);
+                    BOOST_ASIO_CORO_YIELD net::post(*home, *this);
+                }
+
+                state->done.set_value();
+            }
+        }
+    };
+
+    LoopState coroutine;
+    coroutine.n = n;
+    report(name, "coroutine", n, wait_loop(coroutine, [&] { Coroutine(&coroutine, &ctx, &peer.ctx())(); }));
+}
+
+// handlers posted from this thread to another one, until the last of them ran
+void bench_post()
+{
+    static const char* name = "thread_post";
+    if (!selected(name))
+    {
+        return;
+    }
+
+    auto n = g_opts.iterations;
+
+    {
+        Peer peer;
+        std::atomic<size_t> runs{ 0 };
+        fibers::promise<void> done;
+        auto done_future = done.get_future();
+
+        auto begin = Clock::now();
+        for (size_t i = 0; i < n; ++i)
+        {
+            peer.post([&] {
+                if (runs.fetch_add(1, std::memory_order_relaxed) + 1 == n)
+                {
+                    done.set_value();
+                }
+            });
+        }
+        done_future.get();
+        report(name, "fiber_thread", n, Clock::now() - begin);
+    }
+
+    // plain io_context run by a plain thread
+    net::io_context io_ctx;
+    auto work = net::make_work_guard(io_ctx);
+    std::thread runner([&] { io_ctx.run(); });
+
+    std::atomic<size_t> runs{ 0 };
+    fibers::promise<void> done;
+    auto done_future = done.get_future();
+
+    auto begin = Clock::now();
+    for (size_t i = 0; i < n; ++i)
+    {
+        net::post(io_ctx, [&] {
+            if (runs.fetch_add(1, std::memory_order_relaxed) + 1 == n)
+            {
+                done.set_value();
+            }
+        });
+    }
+    done_future.get();
+    report(name, "callback", n, Clock::now() - begin);
+
+    work.reset();
+    runner.join();
+}
+
+int async_main(asio_fiber::ThreadContext& ctx)
+{
+    bench_op(ReadyOp{ ctx });
+
+    net::steady_timer timer(ctx);
+    bench_op(TimerOp{ timer });
+
+    bench_timeout(ctx);
+    bench_spawn(ctx);
+    bench_notify(ctx);
+    bench_post();
+
+    return 0;
+}
+
+int main(int argc, const char *argv[])
+{
+    if (!g_opts.parse(argc, argv))
+    {
+        return -1;
+    }
+
+    asio_fiber::ThreadGuard<> guard;
+    return guard(async_main);
+}
@@ -0,0 +1,403 @@
+#include <cstdio>
+#include <iostream>
+#include <vector>
+
+#include "boost/asio.hpp"
+#include "boost/beast.hpp"
+#include "boost/convert.hpp"
+#include "boost/convert/strtol.hpp"
+#include "boost/fiber/buffered_channel.hpp"
+#include "boost/fiber/condition_variable.hpp"
+#include "boost/fiber/mutex.hpp"
+#include "boost/fiber/operations.hpp"
+#include "boost/optional.hpp"
+#include "boost/program_options.hpp"
+
+#include "asio_fiber/log.h"
+#include "asio_fiber/yield.h"
+#include "asio_fiber/thread.h"
+
+namespace fibers = boost::fibers;
+namespace this_fiber = boost::this_fiber;
+namespace net = boost::asio;
+namespace beast = boost::beast;
+namespace http = beast::http;
+
+using Clock = std::chrono::steady_clock;
+
+struct Options
+{
+    std::string addr;
+    std::string path;
+    size_t threads = 1;
+    size_t connections = 1;
+    size_t rate = 0;
+    size_t duration = 10;
+
+    bool parse(int argc, const char *argv[])
+    {
+        namespace po = boost::program_options;
+
+        po::options_description desc("http load generator");
+        desc.add_options()
+            ("help,H", "print help info")
+            ("addr,A", po::value(&addr)->default_value("127.0.0.1:8080"), "server addr [ip:port]")
+            ("path,P", po::value(&path)->default_value("/"), "request target")
+            ("threads,T", po::value(&threads)->default_value(1), "worker threads")
+            ("connections,C", po::value(&connections)->default_value(1), "keep-alive connections over all threads")
+            ("rate,R", po::value(&rate)->default_value(0), "open loop requests per second over all threads, 0 runs closed loop")
+            ("duration,D", po::value(&duration)->default_value(10), "seconds to run");
+
+        po::variables_map vars;
+        try
+        {
+            po::store(po::parse_command_line(argc, argv, desc), vars);
+        }
+        catch (const std::exception& e)
+        {
+            std::cerr << "parse opts failed,err=" << e.what() << std::endl;
+            return false;
+        }
+
+        vars.notify();
+
+        if (vars.count("help"))
+        {
+            desc.print(std::clog, 4);
+            return false;
+        }
+
+        if (0 == threads || connections < threads)
+        {
+            std::cerr << "need at least one connection per thread" << std::endl;
+            return false;
+        }
+
+        if (rate > 0 && rate < threads)
+        {
+            std::cerr << "need at least one request per second per thread" << std::endl;
+            return false;
+        }
+
+        return true;
+    }
+
+    boost::system::result<net::ip::tcp::endpoint> get_raddr() const
+    {
+        auto pos = addr.rfind(':');
+        if (pos == std::string::npos)
+        {
+            return boost::system::errc::make_error_code(boost::system::errc::bad_address);
+        }
+
+        boost::system::error_code ec;
+        auto ip = net::ip::make_address(addr.substr(0, pos), ec);
+        if (ec)
+        {
+            return ec;
+        }
+
+        // a malformed or out of range port is a bad address, not an exception
+        auto port = boost::convert<uint16_t>(addr.substr(pos + 1), boost::cnv::strtol{});
+        if (!port.has_value())
+        {
+            return boost::system::errc::make_error_code(boost::system::errc::bad_address);
+        }
+
+        return net::ip::tcp::endpoint{ ip, *port };
+    }
+} g_opts;
+
+// log-linear buckets in the spirit of HdrHistogram, values keep 7 significant bits (< 1% error)
+class Histogram
+{
+public:
+    Histogram() : _counts(kBuckets, 0) {}
+
+    void record(uint64_t value) noexcept
+    {
+        ++_counts[index_of(value)];
+        ++_total;
+        _max = (std::max)(_max, value);
+    }
+
+    void merge(const Histogram& other) noexcept
+    {
+        for (size_t i = 0; i < kBuckets; ++i)
+        {
+            _counts[i] += other._counts[i];
+        }
+
+        _total += other._total;
+        _max = (std::max)(_max, other._max);
+    }
+
+    // upper bound of the bucket holding the p-th percentile
+    uint64_t percentile(double p) const noexcept
+    {
+        if (0 == _total)
+        {
+            return 0;
+        }
+
+        auto rank = static_cast<uint64_t>(p / 100.0 * _total + 0.5);
+        rank = (std::max)(rank, uint64_t(1));
+
+        uint64_t seen = 0;
+        for (size_t i = 0; i < kBuckets; ++i)
+        {
+            seen += _counts[i];
+            if (seen >= rank)
+            {
+                return (std::min)(upper_of(i), _max);
+            }
+        }
+
+        return _max;
+    }
+
+    uint64_t max() const noexcept { return _max; }
+    uint64_t total() const noexcept { return _total; }
+private:
+    static constexpr unsigned kSubBits = 7;
+    static constexpr uint64_t kLinear = uint64_t(1) << kSubBits;
+    static constexpr uint64_t kHalf = kLinear / 2;
+    static constexpr size_t kBuckets = kLinear + (64 - kSubBits) * kHalf;
+
+    static size_t index_of(uint64_t value) noexcept
+    {
+        if (value < kLinear)
+        {
+            return static_cast<size_t>(value);
+        }
+
+        unsigned msb = 63;
+        while (0 == (value >> msb))
+        {
+            --msb;
+        }
+
+        auto shift = msb - (kSubBits - 1);
+        return static_cast<size_t>(kLinear + (shift - 1) * kHalf + ((value >> shift) - kHalf));
+    }
+
+    static uint64_t upper_of(size_t index) noexcept
+    {
+        if (index < kLinear)
+        {
+            return index;
+        }
+
+        auto shift = (index - kLinear) / kHalf + 1;
+        auto mantissa = (index - kLinear) % kHalf + kHalf;
+        return ((mantissa + 1) << shift) - 1;
+    }
+
+    std::vector<uint64_t> _counts;
+    uint64_t _total = 0;
+    uint64_t _max = 0;
+};
+
+// owned by one worker thread, merged by main once every worker returned
+struct WorkerStats
+{
+    Histogram latency_ns;
+    uint64_t errors = 0;
+};
+
+void run_connection(asio_fiber::ThreadContext& io_ctx, const net::ip::tcp::endpoint& raddr, Clock::time_point end,
+    fibers::buffered_channel<Clock::time_point>* schedule, WorkerStats& stats)
+{
+    net::ip::tcp::socket sock(io_ctx);
+    beast::flat_buffer buf;
+    boost::optional<http::response_parser<http::string_body>> parser;
+
+    http::request<http::empty_body> req{ http::verb::get, g_opts.path, 11 };
+    req.set(http::field::host, g_opts.addr);
+    req.set(http::field::user_agent, BOOST_BEAST_VERSION_STRING);
+    req.keep_alive(true);
+
+    while (true)
+    {
+        // latency counts from when the request was due, so a slow server cannot hide queueing delay
+        Clock::time_point intended;
+        if (schedule)
+        {
+            if (fibers::channel_op_status::success != schedule->pop(intended))
+            {
+                break;
+            }
+        }
+        else
+        {
+            intended = Clock::now();
+            if (intended >= end)
+            {
+                break;
+            }
+        }
+
+        if (!sock.is_open())
+        {
+            auto c = sock.async_connect(raddr, asio_fiber::yield());
+            if (!c)
+            {
+                ASIO_FIBER_LOG(WARN, "connect failed,err=", c.error().message());
+                ++stats.errors;
+                sock.close();
+                this_fiber::sleep_for(std::chrono::milliseconds(10));
+                continue;
+            }
+
+            sock.set_option(net::ip::tcp::no_delay(true));
+            buf.clear();
+        }
+
+        auto w = http::async_write(sock, req, asio_fiber::yield());
+        if (!w)
+        {
+            ASIO_FIBER_LOG(WARN, "write failed,err=", w.error().message());
+            ++stats.errors;
+            sock.close();
+            continue;
+        }
+
+        parser.emplace();
+        auto r = http::async_read(sock, buf, *parser, asio_fiber::yield());
+        if (!r)
+        {
+            ASIO_FIBER_LOG(WARN, "read failed,err=", r.error().message());
+            ++stats.errors;
+            sock.close();
+            continue;
+        }
+
+        stats.latency_ns.record(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - intended).count());
+
+        if (!parser->get().keep_alive())
+        {
+            sock.close();
+        }
+    }
+
+    boost::system::error_code ec;
+    sock.close(ec);
+}
+
+// open loop: requests fall due at a constant rate whether or not earlier ones completed
+void run_schedule(size_t rate, Clock::time_point start, Clock::time_point end,
+    fibers::buffered_channel<Clock::time_point>& schedule)
+{
+    auto interval = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / rate));
+
+    for (auto due = start; due < end; due += interval)
+    {
+        this_fiber::sleep_until(due);
+
+        if (fibers::channel_op_status::success != schedule.push(due))
+        {
+            break;
+        }
+    }
+
+    schedule.close();
+}
+
+void run_worker(asio_fiber::ThreadContext& io_ctx, const net::ip::tcp::endpoint& raddr, size_t connections,
+    size_t rate, Clock::time_point start, Clock::time_point end, WorkerStats& stats)
+{
+    boost::optional<fibers::buffered_channel<Clock::time_point>> schedule;
+    std::vector<fibers::fiber> fibers;
+
+    if (rate > 0)
+    {
+        schedule.emplace(4096);
+        fibers.push_back(io_ctx.spawn(run_schedule, rate, start, end, std::ref(*schedule)));
+    }
+
+    this_fiber::sleep_until(start);
+
+    for (size_t i = 0; i < connections; ++i)
+    {
+        fibers.push_back(io_ctx.spawn(run_connection, std::ref(io_ctx), std::cref(raddr), end,
+            schedule ? schedule.get_ptr() : nullptr, std::ref(stats)));
+    }
+
+    for (auto&& f : fibers)
+    {
+        f.join();
+    }
+}
+
+int async_main(asio_fiber::ThreadContext& io_ctx)
+{
+    auto raddr = g_opts.get_raddr();
+    if (!raddr)
+    {
+        std::cerr << "bad addr param" << std::endl;
+        return -1;
+    }
+
+    std::vector<WorkerStats> stats(g_opts.threads);
+
+    fibers::mutex mutex;
+    fibers::condition_variable cnd;
+    size_t running = g_opts.threads;
+
+    auto start = Clock::now() + std::chrono::milliseconds(100);
+    auto end = start + std::chrono::seconds(g_opts.duration);
+
+    asio_fiber::ThreadGroup<> tg;
+    for (size_t i = 0; i < g_opts.threads; ++i)
+    {
+        auto connections = g_opts.connections / g_opts.threads + (i < g_opts.connections % g_opts.threads ? 1 : 0);
+        auto rate = g_opts.rate / g_opts.threads + (i < g_opts.rate % g_opts.threads ? 1 : 0);
+
+        auto& worker_stats = stats[i];
+        tg.add_thread([&, connections, rate](asio_fiber::ThreadContext& ctx) {
+            run_worker(ctx, *raddr, connections, rate, start, end, worker_stats);
+
+            std::lock_guard<fibers::mutex> lock(mutex);
+            --running;
+            cnd.notify_all();
+        });
+    }
+
+    {
+        std::unique_lock<fibers::mutex> lock(mutex);
+        cnd.wait(lock, [&] { return 0 == running; });
+    }
+
+    auto elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+    tg.stop_all();
+
+    Histogram merged;
+    uint64_t errors = 0;
+    for (auto&& s : stats)
+    {
+        merged.merge(s.latency_ns);
+        errors += s.errors;
+    }
+
+    auto us = [](uint64_t ns) { return ns / 1000.0; };
+
+    std::printf("mode=%s threads=%zu connections=%zu rate=%zu duration=%.2fs\n",
+        g_opts.rate > 0 ? "open" : "closed", g_opts.threads, g_opts.connections, g_opts.rate, elapsed);
+    std::printf("requests=%llu errors=%llu throughput=%.1f req/s\n",
+        static_cast<unsigned long long>(merged.total()), static_cast<unsigned long long>(errors), merged.total() / elapsed);
+    std::printf("latency us: p50=%.1f p99=%.1f p99.9=%.1f max=%.1f\n",
+        us(merged.percentile(50)), us(merged.percentile(99)), us(merged.percentile(99.9)), us(merged.max()));
+
+    return 0;
+}
+
+int main(int argc, const char *argv[])
+{
+    if (!g_opts.parse(argc, argv))
+    {
+        return -1;
+    }
+
+    asio_fiber::ThreadGuard<> guard;
+    return guard(async_main);
+}
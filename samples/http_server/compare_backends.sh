@@ -0,0 +1,42 @@
+#!/usr/bin/env bash
+# epoll vs io_uring on http_server: requests/s and syscalls per request.
+# needs cmake, liburing, wrk and perf (raw_syscalls tracepoint, usually root).
+# usage: compare_backends.sh [duration_s] [connections]
+set -euo pipefail
+
+SRC_DIR=$(cd "$(dirname "$0")/../.." && pwd)
+DURATION=${1:-10}
+CONNS=${2:-64}
+ADDR=127.0.0.1:18080
+
+run_backend() {
+    local name=$1 uring=$2
+    local build="$SRC_DIR/_build_$name"
+
+    cmake -S "$SRC_DIR" -B "$build" -DCMAKE_BUILD_TYPE=Release -DASIO_FIBER_IO_URING="$uring" > /dev/null
+    cmake --build "$build" --target http_server -j"$(nproc)" > /dev/null
+
+    "$build/http_server" --addr "$ADDR" 2> /dev/null &
+    local pid=$!
+    sleep 1
+
+    perf stat -e raw_syscalls:sys_enter -p "$pid" -x, -o "$build/perf.csv" &
+    local perf_pid=$!
+
+    local rps
+    rps=$(wrk -t2 -c"$CONNS" -d"${DURATION}s" "http://$ADDR/" | awk '/Requests\/sec/ { print $2 }')
+
+    kill -INT "$perf_pid"
+    wait "$perf_pid" || true
+    kill -TERM "$pid"
+    wait "$pid" || true
+
+    local syscalls
+    syscalls=$(awk -F, '/raw_syscalls/ { print $1 }' "$build/perf.csv")
+
+    awk -v n="$name" -v r="$rps" -v s="$syscalls" -v d="$DURATION" \
+        'BEGIN { printf "%-10s %12.1f req/s %10.2f syscalls/req\n", n, r, s / (r * d) }'
+}
+
+run_backend epoll OFF
+run_backend io_uring ON
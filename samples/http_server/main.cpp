@@ -1,24 +1,29 @@
+#include <array>
+#include <atomic>
 #include <iostream>
 #include <sstream>
 
 #include "boost/asio.hpp"
 #include "boost/beast.hpp"
+#include "boost/fiber/condition_variable.hpp"
+#include "boost/fiber/mutex.hpp"
 #include "boost/program_options.hpp"
 #include "boost/system.hpp"
 #include "boost/algorithm/string.hpp"
 #include "boost/container/static_vector.hpp"
 #include "boost/convert.hpp"
 #include "boost/convert/strtol.hpp"
-#include "boost/signals2/signal.hpp"
-#include "boost/core/ignore_unused.hpp"
-#include "boost/scope_exit.hpp"
+#include "boost/optional.hpp"
 
 #ifdef _USE_SSL
     #include "boost/asio/ssl.hpp"
 #endif
 
+#include "asio_fiber/log.h"
+#include "asio_fiber/object.h"
 #include "asio_fiber/yield.h"
 #include "asio_fiber/thread.h"
+#include "asio_fiber/uring.h"
 
 namespace fibers = boost::fibers;
 namespace this_fiber = boost::this_fiber;
@@ -26,9 +31,17 @@ namespace net = boost::asio;
 namespace beast = boost::beast;
 namespace http = beast::http;
 
+#ifdef SO_REUSEPORT
+using reuse_port = net::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>;
+#endif
+
 struct Options
 {
     size_t count = 0;
+    size_t threads = 1;
+    size_t idle_timeout = 15;
+    size_t request_timeout = 30;
+    size_t drain_timeout = 10;
     std::string addr;
     std::string redirect;
     std::string origin;
@@ -47,7 +60,11 @@ struct Options
             ("redirect,R", po::value(&redirect), "302 redirect addr [host:port]")
             ("origin", po::value(&origin)->default_value("tct"), "302 response Origin header")
             ("tcurl", po::value(&tcurl)->default_value("http://tpl.edgeorgn.com/live"), "302 response TcUrl header")
-            ("app", po::value(&app)->default_value("live"), "302 response stream app");
+            ("app", po::value(&app)->default_value("live"), "302 response stream app")
+            ("threads,T", po::value(&threads)->default_value(1), "worker threads, each accepts on its own SO_REUSEPORT socket")
+            ("idle-timeout", po::value(&idle_timeout)->default_value(15), "keep-alive connection idle timeout in seconds")
+            ("request-timeout", po::value(&request_timeout)->default_value(30), "seconds to read a request and write its response")
+            ("drain-timeout", po::value(&drain_timeout)->default_value(10), "seconds requests in flight get to finish on exit");
 
         po::variables_map vars;
         try
@@ -68,6 +85,20 @@ struct Options
             return false;
         }
 
+        if (0 == threads)
+        {
+            std::cerr << "threads must be at least 1" << std::endl;
+            return false;
+        }
+
+#ifndef SO_REUSEPORT
+        if (threads > 1)
+        {
+            std::cerr << "threads > 1 needs SO_REUSEPORT" << std::endl;
+            return false;
+        }
+#endif
+
         return true;
     }
 
@@ -79,7 +110,7 @@ struct Options
         boost::algorithm::split(args, this->addr, boost::is_any_of(":"));
         if (args.size() != 2)
         {
-            std::cerr << "bad addr param" << std::endl;
+            ASIO_FIBER_LOG(ERR, "bad addr param");
             return system::errc::make_error_code(system::errc::bad_address);
         }
 
@@ -87,14 +118,14 @@ struct Options
         auto addr = net::ip::address::from_string(args[0], ec);
         if (ec)
         {
-            std::cerr << "bad addr ip param" << std::endl;
+            ASIO_FIBER_LOG(ERR, "bad addr ip param");
             return ec;
         }
 
         auto r = boost::convert<uint16_t>(args[1], boost::cnv::strtol{});
         if (!r.has_value())
         {
-            std::cerr << "bad addr port param" << std::endl;
+            ASIO_FIBER_LOG(ERR, "bad addr port param");
             return system::errc::make_error_code(system::errc::bad_address);
         }
 
@@ -102,29 +133,117 @@ struct Options
     }
 } g_opts;
 
-struct AppCtx
+// the 302 serialized once, a request only fills in its counter, host and connection line.
+// the whole response goes out in one gather write without allocating
+class RedirectTemplate
 {
-    size_t req_count = 0;
-    boost::signals2::signal<void()> on_close;
+public:
+    RedirectTemplate()
+    {
+        _head = std::string("Server: ") + BOOST_BEAST_VERSION_STRING + "\r\n"
+            + "Origin: " + g_opts.origin + "\r\n"
+            + "TcUrl: " + g_opts.tcurl + "\r\n"
+            + "Content-Length: 0\r\n"
+            + "X-ReqCount: ";
+        _tail = "/" + g_opts.app + "\r\n";
+    }
+
+    template<typename AsyncStream>
+    boost::system::result<size_t>
+    send(AsyncStream& client, unsigned version, bool keep_alive, size_t req_count, beast::string_view host) const
+    {
+        static const beast::string_view s_location = "\r\nLocation: http://";
+
+        char digits[20];
+        auto end = digits + sizeof(digits);
+        auto begin = end;
+        do
+        {
+            *--begin = static_cast<char>('0' + req_count % 10);
+            req_count /= 10;
+        } while (req_count > 0);
+
+        std::array<net::const_buffer, 7> buffers{
+            to_buffer(status_line(version)),
+            net::buffer(_head),
+            net::buffer(begin, end - begin),
+            to_buffer(s_location),
+            to_buffer(host),
+            net::buffer(_tail),
+            to_buffer(connection_line(version, keep_alive))
+        };
+
+        return net::async_write(client, buffers, asio_fiber::yield());
+    }
+private:
+    static net::const_buffer to_buffer(beast::string_view s) noexcept
+    {
+        return { s.data(), s.size() };
+    }
 
-    void close()
+    static beast::string_view status_line(unsigned version) noexcept
     {
-        on_close();
+        return 10 == version ? "HTTP/1.0 302 Found\r\n" : "HTTP/1.1 302 Found\r\n";
     }
+
+    // what beast keep_alive() would set, ends the header block
+    static beast::string_view connection_line(unsigned version, bool keep_alive) noexcept
+    {
+        if (10 == version)
+        {
+            return keep_alive ? "Connection: keep-alive\r\n\r\n" : "\r\n";
+        }
+
+        return keep_alive ? "\r\n" : "Connection: close\r\n\r\n";
+    }
+
+    std::string _head;
+    std::string _tail;
 };
 
+struct AppCtx;
+
+// shared by all shards, /metrics reports every thread whichever shard serves it
+struct Metrics
+{
+    // nullptr when the app runs on the main thread alone
+    const asio_fiber::ThreadGroup<>* group = nullptr;
+    std::vector<std::shared_ptr<AppCtx>> shards;
+
+    std::string render() const;
+};
+
+// one per shard, only req_count drives the redirect rotation of its own shard
+struct AppCtx
+{
+    size_t req_count = 0;
+    RedirectTemplate redirect;
+    // read by other threads when combined, see total_served
+    std::atomic<size_t> served{ 0 };
+    // outlives every shard, see run_shards
+    const Metrics* metrics = nullptr;
+};
+
+// registered with its thread, so that a smooth stop closes idle keep-alive connections
+// at once and busy ones after their response. beast::tcp_stream times reads and writes out
+// itself, beast operations may not honor the cancellation a yield() timeout emits
+using Client = asio_fiber::Object<beast::tcp_stream>;
+
 template<typename AsyncStream>
 struct StreamTraits
 {
+    // the socket being readable means a request has started, nothing is buffered above it
+    static constexpr bool idle_wait_on_socket = true;
+
     static void close(AsyncStream& stream)
     {
         stream.close();
     }
 
     static typename std::decay<AsyncStream>::type::endpoint_type
-    local_endpoint(const AsyncStream& stream)
+    local_endpoint(AsyncStream& stream)
     {
-        return stream.local_endpoint();
+        return stream.socket().local_endpoint();
     }
 };
 
@@ -132,69 +251,258 @@ struct StreamTraits
 template<typename AsyncStream>
 struct StreamTraits<net::ssl::stream<AsyncStream>>
 {
+    // records may be decrypted and buffered already, or the socket readable for a record that is no request
+    static constexpr bool idle_wait_on_socket = false;
+
     static void close(net::ssl::stream<AsyncStream>& stream)
     {
-        stream.async_shutdown(asio_fiber::yield);
-        stream.lowest_layer().close();
+        stream.async_shutdown(asio_fiber::yield());
+        beast::get_lowest_layer(stream).close();
     }
 
-    static typename AsyncStream::endpoint_type local_endpoint(const net::ssl::stream<AsyncStream>& stream)
+    static typename AsyncStream::endpoint_type local_endpoint(net::ssl::stream<AsyncStream>& stream)
     {
-        return stream.lowest_layer().local_endpoint();
+        return beast::get_lowest_layer(stream).socket().local_endpoint();
     }
 };
 #endif
 
-template<typename AsyncStream>
-boost::system::result<void>
-service_fn(AsyncStream client, const std::shared_ptr<AppCtx>& app_ctx)
+size_t total_served(const std::vector<std::shared_ptr<AppCtx>>& shards)
 {
-    beast::flat_buffer buf(8096);
-    http::request<http::dynamic_body> req;
+    size_t n = 0;
+    for (auto&& app_ctx : shards)
+    {
+        n += app_ctx->served.load(std::memory_order_relaxed);
+    }
+
+    return n;
+}
 
-    auto ret = http::async_read(client, buf, req, asio_fiber::yield());
-    if (!ret)
+// prometheus text format, handlers per wake is rate(handlers_total) / rate(wakes_total)
+std::string Metrics::render() const
+{
+    std::vector<asio_fiber::AlgorithmStatsSnapshot> stats;
+    if (group)
     {
-        std::clog << "client read failed,err=" << ret.error().message() << std::endl;
-        return ret.error();
+        stats = group->get_stats();
+    }
+    else
+    {
+        stats.push_back(asio_fiber::ThreadContext::current()->get_stats().snapshot());
     }
 
-    std::clog << "Got http req=" << req.target() << std::endl;
+    std::ostringstream os;
 
-    http::response<http::empty_body> resp{ http::status::found, req.version() };
+    auto family = [&](const char* name, const char* type, const char* help,
+        double (*value)(const asio_fiber::AlgorithmStatsSnapshot&)) {
+        os << "# HELP " << name << ' ' << help << "\n# TYPE " << name << ' ' << type << '\n';
+        for (size_t i = 0; i < stats.size(); ++i)
+        {
+            os << name << "{thread=\"" << i << "\"} " << value(stats[i]) << '\n';
+        }
+    };
+
+    using Snapshot = asio_fiber::AlgorithmStatsSnapshot;
+
+    family("asio_fiber_switches_total", "counter", "Fibers picked to run.",
+        [](const Snapshot& s) { return double(s.switches); });
+    family("asio_fiber_budget_polls_total", "counter", "Polls forced by a spent fairness budget.",
+        [](const Snapshot& s) { return double(s.budget_polls); });
+    family("asio_fiber_wakes_total", "counter", "Returns from suspend_until.",
+        [](const Snapshot& s) { return double(s.wakes); });
+    family("asio_fiber_handlers_total", "counter", "Asio handlers run on wake.",
+        [](const Snapshot& s) { return double(s.handlers); });
+    family("asio_fiber_notifies_total", "counter", "Cross-thread scheduler notifies.",
+        [](const Snapshot& s) { return double(s.notifies); });
+    family("asio_fiber_coalesced_notifies_total", "counter", "Notifies folded into a pending wakeup.",
+        [](const Snapshot& s) { return double(s.coalesced_notifies); });
+    family("asio_fiber_suspend_seconds_total", "counter", "Time in suspend_until.",
+        [](const Snapshot& s) { return s.suspend_ns / 1e9; });
+    family("asio_fiber_sleep_seconds_total", "counter", "Time blocked in the io_context.",
+        [](const Snapshot& s) { return s.sleep_ns / 1e9; });
+    family("asio_fiber_spin_seconds_total", "counter", "Time busy polling the io_context.",
+        [](const Snapshot& s) { return s.spin_ns / 1e9; });
+    family("asio_fiber_ready_fibers", "gauge", "Ready queue depth.",
+        [](const Snapshot& s) { return double(s.ready); });
+    family("asio_fiber_ready_fibers_max", "gauge", "Deepest ready queue seen.",
+        [](const Snapshot& s) { return double(s.ready_max); });
+    family("asio_fiber_spawned_fibers", "gauge", "Spawned fibers still alive.",
+        [](const Snapshot& s) { return double(s.fibers); });
+
+    os << "# HELP http_server_requests_total Requests served.\n# TYPE http_server_requests_total counter\n"
+        << "http_server_requests_total " << total_served(shards) << '\n';
+
+    return os.str();
+}
+
+template<typename AsyncStream>
+boost::system::result<void>
+send_metrics(AsyncStream& client, const Metrics& metrics, unsigned version, bool keep_alive)
+{
+    http::response<http::string_body> resp{ http::status::ok, version };
     resp.set(http::field::server, BOOST_BEAST_VERSION_STRING);
-    resp.set(http::field::origin, g_opts.origin);
-    resp.set("X-ReqCount", std::to_string(app_ctx->req_count));
-    resp.set("TcUrl", g_opts.tcurl);
+    resp.set(http::field::content_type, "text/plain; version=0.0.4");
+    resp.keep_alive(keep_alive);
+    resp.body() = metrics.render();
     resp.prepare_payload();
 
-    std::ostringstream loc_builder;
-    loc_builder << "http://";
-
-    if (app_ctx->req_count++ >= g_opts.count && !g_opts.redirect.empty())
+    auto r = http::async_write(client, resp, asio_fiber::yield());
+    if (!r)
     {
-        app_ctx->req_count = 0;
-        loc_builder << g_opts.redirect;
+        return r.error();
     }
-    else
+
+    return {};
+}
+
+template<typename AsyncStream>
+boost::system::result<void>
+service_fn(AsyncStream& client, const std::shared_ptr<AppCtx>& app_ctx)
+{
+    auto io_ctx = asio_fiber::ThreadContext::current();
+
+    // redirects to this host until the rotation picks g_opts.redirect
+    std::ostringstream local_builder;
+    local_builder << StreamTraits<AsyncStream>::local_endpoint(client);
+    auto local_host = local_builder.str();
+
+    // both live as long as the connection, pipelined requests already buffered are parsed first
+    beast::flat_buffer buf(8096);
+    boost::optional<http::request_parser<http::dynamic_body>> parser;
+
+    while (!io_ctx->stopping())
     {
-        loc_builder << StreamTraits<AsyncStream>::local_endpoint(client);
-    }
+        // a parser handles one message, emplace reuses its storage
+        parser.emplace();
+
+        auto& stream = beast::get_lowest_layer(client);
+        boost::optional<Client::Busy> busy;
+        auto timeout = std::chrono::seconds(g_opts.request_timeout);
+
+        if (StreamTraits<AsyncStream>::idle_wait_on_socket)
+        {
+            // idle until the next request starts, waited on the socket since beast reads may not honor cancellation
+            if (0 == buf.size())
+            {
+                stream.expires_never();
+
+                auto idle = stream.socket().async_wait(net::socket_base::wait_read,
+                    asio_fiber::yield(std::chrono::seconds(g_opts.idle_timeout)));
+                if (!idle)
+                {
+                    ASIO_FIBER_LOG(DEBUG, "client idle,err=", idle.error().message());
+                    break;
+                }
+            }
+
+            // a stop now waits for the response to this request
+            busy.emplace(stream.busy());
+        }
+        else
+        {
+            // the read itself waits for the next request
+            timeout += std::chrono::seconds(g_opts.idle_timeout);
+        }
 
-    loc_builder << "/" << g_opts.app;
-    auto loc = loc_builder.str();
+        // bounds the request and its response, so that a slow client cannot hold the connection
+        stream.expires_after(timeout);
 
-    resp.set(http::field::location, loc);
+        auto ret = http::async_read(client, buf, *parser, asio_fiber::yield());
+        if (!ret)
+        {
+            if (ret.error() != http::error::end_of_stream)
+            {
+                ASIO_FIBER_LOG(WARN, "client read failed,err=", ret.error().message());
+            }
 
-    auto r = http::async_write(client, resp, asio_fiber::yield());
+            return ret.error();
+        }
+
+        if (!busy)
+        {
+            busy.emplace(stream.busy());
+        }
+
+        auto& req = parser->get();
+
+        ASIO_FIBER_LOG(DEBUG, "Got http req=", req.target());
+
+        app_ctx->served.fetch_add(1, std::memory_order_relaxed);
+
+        if (app_ctx->metrics && "/metrics" == req.target())
+        {
+            auto m = send_metrics(client, *app_ctx->metrics, req.version(), req.keep_alive());
+            if (!m)
+            {
+                return m.error();
+            }
+
+            if (!req.keep_alive())
+            {
+                break;
+            }
+
+            continue;
+        }
+
+        auto req_count = app_ctx->req_count;
+        beast::string_view host = local_host;
+
+        if (app_ctx->req_count++ >= g_opts.count && !g_opts.redirect.empty())
+        {
+            app_ctx->req_count = 0;
+            host = g_opts.redirect;
+        }
 
-    std::clog << "Send http response=" << loc << ",ok=" << r.has_value() << std::endl;
+        // responses go out in request order, the next request is read only after this write
+        auto r = app_ctx->redirect.send(client, req.version(), req.keep_alive(), req_count, host);
+
+        ASIO_FIBER_LOG(DEBUG, "Send http response=http://", host, "/", g_opts.app, ",ok=", r.has_value());
+
+        if (!r)
+        {
+            return r.error();
+        }
+
+        if (!req.keep_alive())
+        {
+            break;
+        }
+    }
+
+    StreamTraits<AsyncStream>::close(client);
 
     return {};
 }
 
+#ifdef _USE_SSL
 boost::system::result<void>
-serve_http(net::io_context& io_ctx, const std::shared_ptr<AppCtx>& app_ctx)
+serve_client(net::ip::tcp::socket socket, const std::shared_ptr<net::ssl::context>& ssl_ctx,
+    const std::shared_ptr<AppCtx>& app_ctx)
+{
+    net::ssl::stream<Client> client(beast::tcp_stream(std::move(socket)), *ssl_ctx);
+
+    beast::get_lowest_layer(client).expires_after(std::chrono::seconds(g_opts.request_timeout));
+    auto hs_ret = client.async_handshake(net::ssl::stream_base::server, asio_fiber::yield());
+    if (!hs_ret)
+    {
+        ASIO_FIBER_LOG(WARN, "ssl hs failed,err=", hs_ret.error().message());
+        return hs_ret.error();
+    }
+
+    return service_fn(client, app_ctx);
+}
+#else
+boost::system::result<void>
+serve_client(net::ip::tcp::socket socket, const std::shared_ptr<AppCtx>& app_ctx)
+{
+    Client client(beast::tcp_stream(std::move(socket)));
+    return service_fn(client, app_ctx);
+}
+#endif
+
+boost::system::result<void>
+serve_http(asio_fiber::ThreadContext& io_ctx, const std::shared_ptr<AppCtx>& app_ctx)
 {
     auto r = g_opts.get_laddr();
     if (!r)
@@ -204,70 +512,70 @@ serve_http(net::io_context& io_ctx, const std::shared_ptr<AppCtx>& app_ctx)
 
     boost::system::error_code ec;
 
-    auto acceptor = std::make_shared<net::ip::tcp::acceptor>(io_ctx, net::ip::tcp::v4());
-    acceptor->bind(*r, ec);
+    // a stop of the thread closes it
+    asio_fiber::Object<net::ip::tcp::acceptor> acceptor(net::ip::tcp::v4());
+
+#ifdef SO_REUSEPORT
+    if (g_opts.threads > 1)
+    {
+        // every shard listens on the same addr, the kernel spreads connections among them
+        acceptor.set_option(reuse_port(true), ec);
+        if (ec)
+        {
+            ASIO_FIBER_LOG(ERR, "set SO_REUSEPORT failed,err=", ec.message());
+            return ec;
+        }
+    }
+#endif
+
+    acceptor.bind(*r, ec);
     if (ec)
     {
-        std::cerr << "bind failed" << ec.message() << std::endl;
+        ASIO_FIBER_LOG(ERR, "bind failed,err=", ec.message());
         return ec;
     }
 
-    acceptor->listen(net::socket_base::max_listen_connections, ec);
+    acceptor.listen(net::socket_base::max_listen_connections, ec);
     if (ec)
     {
-        std::cerr << "listen failed" << ec.message() << std::endl;
+        ASIO_FIBER_LOG(ERR, "listen failed,err=", ec.message());
         return ec;
     }
 
-    std::clog << "Listen at " << acceptor->local_endpoint() << std::endl;
-
-    boost::signals2::scoped_connection scoped = app_ctx->on_close.connect([acceptor] { acceptor->close(); });
-    boost::ignore_unused(scoped);
-
-    BOOST_SCOPE_EXIT(&acceptor) {
-        acceptor->close();
-    } BOOST_SCOPE_EXIT_END;
+    ASIO_FIBER_LOG(INFO, "Listen at ", acceptor.local_endpoint(), ",backend=", asio_fiber::io_backend_name());
 
 #ifdef _USE_SSL
-    net::ssl::context ssl_ctx(net::ssl::context_base::tls_server);
+    // connections handshake in their own fiber and may outlive this one
+    auto ssl_ctx = std::make_shared<net::ssl::context>(net::ssl::context_base::tls_server);
 
-    ssl_ctx.use_certificate_file("server.crt", net::ssl::context_base::pem);
-    ssl_ctx.set_password_callback(
+    ssl_ctx->use_certificate_file("server.crt", net::ssl::context_base::pem);
+    ssl_ctx->set_password_callback(
         [] (size_t size, net::ssl::context_base::password_purpose) -> std::string {
             return "123456";
         }
     );
-    ssl_ctx.use_private_key_file("server.key", net::ssl::context_base::pem, ec);
+    ssl_ctx->use_private_key_file("server.key", net::ssl::context_base::pem, ec);
 
     if (ec)
     {
-        std::cerr << "use_private_key_file failed" << ec.message() << std::endl;
+        ASIO_FIBER_LOG(ERR, "use_private_key_file failed,err=", ec.message());
         return ec;
     }
 #endif
     while (true)
     {
-        auto client = acceptor->async_accept(asio_fiber::yield());
+        auto client = acceptor.async_accept(asio_fiber::yield());
         if (!client)
         {
             return client.error();
         }
 
-        std::clog << "Accept client=" << client->remote_endpoint() << std::endl;
+        ASIO_FIBER_LOG(DEBUG, "Accept client=", client->remote_endpoint());
 
 #ifdef _USE_SSL
-        net::ssl::stream<net::ip::tcp::socket> ssl_client(std::move(*client), ssl_ctx);
-
-        auto hs_ret = ssl_client.async_handshake(net::ssl::stream_base::server, asio_fiber::yield);
-        if (!hs_ret)
-        {
-            std::cerr << "ssl hs failed,err=" << hs_ret.error().message() << std::endl;
-            continue;
-        }
-
-        fibers::fiber(service_fn<decltype(ssl_client)>, std::move(ssl_client), app_ctx).detach();
+        io_ctx.spawn(serve_client, std::move(*client), ssl_ctx, app_ctx).detach();
 #else
-        fibers::fiber(service_fn<decltype(*client)>, std::move(*client), app_ctx).detach();
+        io_ctx.spawn(serve_client, std::move(*client), app_ctx).detach();
 #endif
     }
 
@@ -275,24 +583,83 @@ serve_http(net::io_context& io_ctx, const std::shared_ptr<AppCtx>& app_ctx)
 }
 
 boost::system::result<void>
-async_main(net::io_context& io_ctx)
+run_app(asio_fiber::ThreadContext& io_ctx, const std::shared_ptr<AppCtx>& app_ctx)
 {
-    auto app_ctx = std::make_shared<AppCtx>();
-
     fibers::fiber(serve_http, std::ref(io_ctx), app_ctx).detach();
 
+    // every shard has its own signal_set, asio notifies all of them
     net::signal_set t(io_ctx, SIGTERM, SIGINT);
     auto sig = t.async_wait(asio_fiber::yield());
     if (!sig)
     {
-        std::clog << "sig=" << sig.error() << std::endl;
+        ASIO_FIBER_LOG(WARN, "sig=", sig.error());
+    }
+
+    // the acceptor and idle connections close now, requests in flight get their response
+    io_ctx.stop(asio_fiber::StopMode::SMOOTH, std::chrono::seconds(g_opts.drain_timeout));
+
+    return {};
+}
+
+boost::system::result<void>
+run_shards(size_t threads)
+{
+    asio_fiber::ThreadGroup<> tg;
+
+    Metrics metrics;
+    metrics.group = &tg;
+
+    auto& shards = metrics.shards;
+    for (size_t i = 0; i < threads; ++i)
+    {
+        shards.push_back(std::make_shared<AppCtx>());
+        shards.back()->metrics = &metrics;
     }
 
-    app_ctx->close();
+    fibers::mutex mutex;
+    fibers::condition_variable cnd;
+    size_t running = shards.size();
+
+    for (auto&& app_ctx : shards)
+    {
+        tg.add_thread([&, app_ctx](asio_fiber::ThreadContext& io_ctx) {
+            run_app(io_ctx, app_ctx);
+
+            std::lock_guard<fibers::mutex> lock(mutex);
+            --running;
+            cnd.notify_all();
+        });
+    }
+
+    // shards stop on their own signal, stopping their contexts earlier could strand them
+    {
+        std::unique_lock<fibers::mutex> lock(mutex);
+        cnd.wait(lock, [&] { return 0 == running; });
+    }
+
+    // the shards are draining already, this waits for them
+    tg.stop_all(asio_fiber::StopMode::SMOOTH, std::chrono::seconds(g_opts.drain_timeout));
+
+    ASIO_FIBER_LOG(INFO, "Served requests=", total_served(shards), ",shards=", shards.size());
 
     return {};
 }
 
+boost::system::result<void>
+async_main(asio_fiber::ThreadContext& io_ctx)
+{
+    if (g_opts.threads > 1)
+    {
+        return run_shards(g_opts.threads);
+    }
+
+    Metrics metrics;
+    metrics.shards.push_back(std::make_shared<AppCtx>());
+    metrics.shards.back()->metrics = &metrics;
+
+    return run_app(io_ctx, metrics.shards.back());
+}
+
 int main(int argc, const char *argv[])
 {
     if (!g_opts.parse(argc, argv))
@@ -1,8 +1,7 @@
-#include <iostream>
-
 #include "boost/asio.hpp"
 #include "boost/beast.hpp"
 
+#include "asio_fiber/log.h"
 #include "asio_fiber/yield.h"
 #include "asio_fiber/object.h"
 
@@ -12,7 +11,51 @@ namespace net = boost::asio;
 namespace beast = boost::beast;
 namespace http = beast::http;
 
-boost::system::result<void> async_http(asio_fiber::ThreadContext& ctx)
+// runs on the worker picked by the acceptor
+void serve_client(net::ip::tcp::socket socket)
+{
+    // registered with the worker, so that stopping it reaches the connection
+    asio_fiber::Object<net::ip::tcp::socket> client(std::move(socket));
+
+    beast::flat_buffer buf(8096);
+    http::request<http::dynamic_body> req;
+
+    auto ret = http::async_read(client, buf, req, asio_fiber::yield());
+    if (!ret)
+    {
+        ASIO_FIBER_LOG(WARN, "client read failed,err=", ret.error().message());
+        client.close();
+        return;
+    }
+
+    if ("/test" == req.target())
+    {
+        return;
+    }
+
+    // a smooth stop lets the response go out first
+    auto busy = client.busy();
+
+    http::response<http::string_body> resp{ http::status::ok, req.version() };
+
+    resp.body() = "hello";
+    resp.set(http::field::server, BOOST_BEAST_VERSION_STRING);
+    resp.set(http::field::content_type, "text/html");
+
+    http::async_write(client, resp, asio_fiber::yield());
+
+    client.close();
+}
+
+// workers only run the connections handed over by the acceptor
+void run_worker(asio_fiber::ThreadContext& ctx)
+{
+    asio_fiber::Object<net::steady_timer> idle;
+    idle.expires_at((net::steady_timer::time_point::max)());
+    idle.async_wait(asio_fiber::yield());
+}
+
+boost::system::result<void> async_http(asio_fiber::ThreadContext& ctx, asio_fiber::ThreadGroup<>& workers)
 {
     using Acceptor = asio_fiber::Object<net::ip::tcp::acceptor>;
     Acceptor acceptor{ net::ip::tcp::v4() };
@@ -21,18 +64,18 @@ boost::system::result<void> async_http(asio_fiber::ThreadContext& ctx)
     acceptor.bind({ net::ip::tcp::v4(), 8080 }, ec);
     if (ec)
     {
-        std::clog << "bind failed" << ec.message() << std::endl;
+        ASIO_FIBER_LOG(ERR, "bind failed,err=", ec.message());
         return ec;
     }
 
     acceptor.listen(net::socket_base::max_listen_connections, ec);
     if (ec)
     {
-        std::clog << "listen failed" << ec.message() << std::endl;
+        ASIO_FIBER_LOG(ERR, "listen failed,err=", ec.message());
         return ec;
     }
 
-    while (!ctx.stopped())
+    while (!ctx.stopping())
     {
         auto client = acceptor.async_accept(asio_fiber::yield());
         if (!client)
@@ -40,35 +83,16 @@ boost::system::result<void> async_http(asio_fiber::ThreadContext& ctx)
             break;
         }
 
-        std::clog << "accept " << client->remote_endpoint() << std::endl;
-
-        fibers::fiber([client = std::move(*client)]() mutable {
-            beast::flat_buffer buf(8096);
-            http::request<http::dynamic_body> req;
+        ASIO_FIBER_LOG(DEBUG, "accept ", client->remote_endpoint());
 
-            auto ret = http::async_read(client, buf, req, asio_fiber::yield());
-            if (!ret)
-            {
-                std::clog << "client read failed,err=" << ret.error().message() << std::endl;
-                client.close();
-                return;
-            }
-
-            if ("/test" == req.target())
-            {
-                return;
-            }
-
-            http::response<http::string_body> resp{ http::status::ok, req.version() };
-
-            resp.body() = "hello";
-            resp.set(http::field::server, BOOST_BEAST_VERSION_STRING);
-            resp.set(http::field::content_type, "text/html");
-
-            http::async_write(client, resp, asio_fiber::yield());
+        auto worker = workers.post_socket(std::move(*client), serve_client);
+        if (!worker)
+        {
+            ASIO_FIBER_LOG(WARN, "hand off client failed,err=", worker.error().message());
+            continue;
+        }
 
-            client.close();
-        }).detach();
+        ASIO_FIBER_LOG(DEBUG, "client to worker ", *worker);
     }
 
     return {};
@@ -78,7 +102,7 @@ int async_main(asio_fiber::ThreadContext& ctx)
 {
     fibers::fiber([&] {
         asio_fiber::Object<net::steady_timer> t;
-        while (!ctx.stopped())
+        while (!ctx.stopping())
         {
             t.expires_after(std::chrono::seconds(1));
             auto sig = t.async_wait(asio_fiber::yield());
@@ -87,21 +111,27 @@ int async_main(asio_fiber::ThreadContext& ctx)
                 break;
             }
 
-            std::clog << "on_timer " << std::chrono::steady_clock::now().time_since_epoch().count() << std::endl;
+            ASIO_FIBER_LOG(DEBUG, "on_timer ", std::chrono::steady_clock::now().time_since_epoch().count());
         }
     }).detach();
 
+    // one acceptor spreads connections over the workers by their load
+    asio_fiber::ThreadGroup<> workers;
+    workers.add_threads((std::max)(2u, std::thread::hardware_concurrency()) - 1, run_worker);
+
     asio_fiber::ThreadGroup<> tg;
-    tg.add_thread(async_http);
+    tg.add_thread([&workers](asio_fiber::ThreadContext& ctx) { return async_http(ctx, workers); });
 
     net::signal_set t(ctx, SIGTERM, SIGINT);
     auto sig = t.async_wait(asio_fiber::yield());
     if (!sig)
     {
-        std::clog << "sig=" << sig.error() << std::endl;
+        ASIO_FIBER_LOG(WARN, "sig=", sig.error());
     }
 
-    tg.stop_all();
+    // stop accepting first, then let the workers finish the requests in flight
+    tg.stop_all(asio_fiber::StopMode::SMOOTH);
+    workers.stop_all(asio_fiber::StopMode::SMOOTH, std::chrono::seconds(10));
 
     return 0;
 }
@@ -0,0 +1,181 @@
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+#include <thread>
+
+#include "boost/test/unit_test.hpp"
+
+#include "asio_fiber/stop_scope.h"
+#include "asio_fiber/thread.h"
+#include "asio_fiber/yield.h"
+
+namespace
+{
+using Clock = std::chrono::steady_clock;
+
+// a target thread which idles until stopped, calls run as fibers beside it
+struct Target
+{
+    Target() : thread([](asio_fiber::ThreadContext& ctx) {
+        while (!ctx.stopping())
+        {
+            boost::this_fiber::sleep_for(std::chrono::milliseconds(2));
+        }
+    }) {}
+
+    ~Target() { thread.stop(); }
+
+    asio_fiber::Thread<> thread;
+};
+
+// no default constructor
+struct Named
+{
+    explicit Named(int v) : value(v) {}
+
+    int value;
+};
+
+// a call which runs on the target until the test releases it, started once it runs there
+struct SlowCall
+{
+    std::atomic<bool> started{ false };
+    std::atomic<bool> released{ false };
+
+    int run()
+    {
+        started = true;
+        auto deadline = Clock::now() + std::chrono::seconds(10);
+        while (!released && Clock::now() < deadline)
+        {
+            boost::this_fiber::sleep_for(std::chrono::milliseconds(2));
+        }
+
+        return 1;
+    }
+};
+}
+
+BOOST_AUTO_TEST_SUITE(call)
+
+BOOST_AUTO_TEST_CASE(returns_the_value_or_the_exception_error)
+{
+    Target target;
+
+    boost::system::result<int> value;
+    boost::system::result<int> thrown;
+    asio_fiber::Thread<> caller([&](asio_fiber::ThreadContext&) {
+        value = target.thread.call([] { return 42; }, asio_fiber::yield());
+        thrown = target.thread.call([]() -> int { throw std::runtime_error("call"); }, asio_fiber::yield());
+    });
+    caller.join();
+
+    BOOST_TEST(value.has_value());
+    BOOST_TEST(*value == 42);
+    BOOST_TEST(!thrown.has_value());
+    BOOST_TEST((thrown.error() == asio_fiber::make_call_exception_error()));
+}
+
+BOOST_AUTO_TEST_CASE(result_without_default_constructor_comes_in_optional)
+{
+    Target target;
+
+    boost::system::result<boost::optional<Named>> value;
+    boost::system::result<boost::optional<Named>> thrown;
+    asio_fiber::Thread<> caller([&](asio_fiber::ThreadContext&) {
+        value = target.thread.call([] { return Named(7); }, asio_fiber::yield());
+        thrown = target.thread.call([]() -> Named { throw std::runtime_error("call"); }, asio_fiber::yield());
+    });
+    caller.join();
+
+    BOOST_TEST(value.has_value());
+    BOOST_TEST((*value && (*value)->value == 7));
+    BOOST_TEST(!thrown.has_value());
+    BOOST_TEST((thrown.error() == asio_fiber::make_call_exception_error()));
+}
+
+BOOST_AUTO_TEST_CASE(timeout_drops_a_slow_result)
+{
+    SlowCall slow;
+    Target target;
+
+    boost::system::result<int> r;
+    Clock::duration took{};
+    asio_fiber::Thread<> caller([&](asio_fiber::ThreadContext&) {
+        auto start = Clock::now();
+        r = target.thread.call([&slow] { return slow.run(); }, asio_fiber::yield(std::chrono::milliseconds(30)));
+        took = Clock::now() - start;
+    });
+    caller.join();
+    slow.released = true;
+
+    BOOST_TEST(!r.has_value());
+    BOOST_TEST((took < std::chrono::seconds(5)));
+}
+
+// a forced stop of the scope of the caller aborts the call, f still runs on the target
+BOOST_AUTO_TEST_CASE(stopped_caller_scope_aborts_the_call)
+{
+    SlowCall slow;
+    Target target;
+
+    boost::system::result<int> r;
+    boost::system::result<int> late;
+    Clock::duration took{};
+    asio_fiber::Thread<> caller([&](asio_fiber::ThreadContext&) {
+        asio_fiber::StopScope scope;
+        auto handle = scope.get_handle();
+
+        // stops once the call runs on the target
+        boost::fibers::fiber stopper([handle, &slow]() mutable {
+            while (!slow.started)
+            {
+                boost::this_fiber::sleep_for(std::chrono::milliseconds(1));
+            }
+
+            handle.stop();
+        });
+
+        auto start = Clock::now();
+        r = target.thread.call([&slow] { return slow.run(); }, asio_fiber::yield());
+        took = Clock::now() - start;
+        stopper.join();
+
+        // nothing new starts in a cancelled scope
+        late = target.thread.call([] { return 2; }, asio_fiber::yield());
+    });
+    caller.join();
+    slow.released = true;
+
+    BOOST_TEST(!r.has_value());
+    BOOST_TEST(!late.has_value());
+    BOOST_TEST((r.error() == boost::asio::error::operation_aborted));
+    BOOST_TEST((took < std::chrono::seconds(5)));
+}
+
+// stopping the whole caller thread does not wait for the call
+BOOST_AUTO_TEST_CASE(stopped_caller_thread_does_not_wait)
+{
+    SlowCall slow;
+    Target target;
+
+    boost::system::result<int> r;
+    asio_fiber::Thread<> caller([&](asio_fiber::ThreadContext&) {
+        r = target.thread.call([&slow] { return slow.run(); }, asio_fiber::yield());
+    });
+
+    while (!slow.started)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    auto start = Clock::now();
+    caller.stop();
+    auto took = Clock::now() - start;
+    slow.released = true;
+
+    BOOST_TEST((took < std::chrono::seconds(5)));
+    BOOST_TEST(!r.has_value());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,163 @@
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "boost/test/unit_test.hpp"
+
+#include "asio_fiber/channel.h"
+
+namespace
+{
+// no default constructor, counts the live copies through its shared_ptr
+struct Payload
+{
+    explicit Payload(std::shared_ptr<int> v) : value(std::move(v)) {}
+
+    std::shared_ptr<int> value;
+};
+}
+
+BOOST_AUTO_TEST_SUITE(channel)
+
+BOOST_AUTO_TEST_CASE(local_channel_keeps_order_across_batches)
+{
+    std::vector<int> received;
+    asio_fiber::Thread<> thread([&](asio_fiber::ThreadContext&) {
+        asio_fiber::LocalChannel<int> ch(4);
+
+        boost::fibers::fiber consumer([&] {
+            std::vector<int> out;
+            while (ch.pop_batch(std::back_inserter(out), 3) > 0) {}
+            received = std::move(out);
+        });
+
+        std::vector<int> values(100);
+        for (int i = 0; i < 100; ++i)
+        {
+            values[i] = i;
+        }
+
+        ch.push_batch(values.begin(), values.begin() + 50);
+        for (int i = 50; i < 100; ++i)
+        {
+            ch.push(i);
+        }
+
+        ch.close();
+        consumer.join();
+    });
+    thread.join();
+
+    BOOST_TEST(received.size() == 100u);
+    for (size_t i = 0; i < received.size(); ++i)
+    {
+        BOOST_TEST(received[i] == static_cast<int>(i));
+    }
+}
+
+// fibers of a group and plain threads fill a small ring, nothing is lost or duplicated
+BOOST_AUTO_TEST_CASE(mpsc_ring_from_fibers_and_threads)
+{
+    const int kPerProducer = 50000;
+    asio_fiber::MpscChannel<int> ch(16);
+
+    long sum = 0;
+    long count = 0;
+    asio_fiber::Thread<> receiver([&](asio_fiber::ThreadContext&) {
+        std::vector<int> out;
+        while (true)
+        {
+            out.clear();
+            if (0 == ch.pop_batch(std::back_inserter(out), 32))
+            {
+                break;
+            }
+
+            for (auto v : out)
+            {
+                sum += v;
+                ++count;
+            }
+        }
+    });
+
+    std::atomic<int> done{ 0 };
+    {
+        asio_fiber::ThreadGroup<> group;
+        group.add_threads(2, [&](asio_fiber::ThreadContext&) {
+            boost::fibers::fiber batches([&] {
+                std::vector<int> ones(8, 1);
+                for (int i = 0; i < kPerProducer / 8; ++i)
+                {
+                    ch.push_batch(ones.begin(), ones.end());
+                }
+            });
+
+            for (int i = 0; i < kPerProducer; ++i)
+            {
+                ch.push(1);
+            }
+
+            batches.join();
+            ++done;
+        });
+
+        std::thread plain([&] {
+            for (int i = 0; i < kPerProducer; ++i)
+            {
+                while (asio_fiber::ChannelStatus::FULL == ch.try_push(2))
+                {
+                    std::this_thread::yield();
+                }
+            }
+        });
+
+        plain.join();
+        while (done.load() < 2)
+        {
+            std::this_thread::yield();
+        }
+
+        group.stop_all();
+    }
+
+    ch.close();
+    receiver.join();
+
+    BOOST_TEST(count == 5L * kPerProducer);
+    BOOST_TEST(sum == 6L * kPerProducer);
+    int v;
+    BOOST_TEST((asio_fiber::ChannelStatus::CLOSED == ch.try_pop(v)));
+    BOOST_TEST((asio_fiber::ChannelStatus::CLOSED == ch.try_push(1)));
+}
+
+BOOST_AUTO_TEST_CASE(mpsc_needs_no_default_constructor)
+{
+    auto probe = std::make_shared<int>(7);
+    {
+        asio_fiber::MpscChannel<Payload> ch(8);
+        for (int i = 0; i < 5; ++i)
+        {
+            BOOST_TEST((asio_fiber::ChannelStatus::SUCCESS == ch.try_push(Payload(probe))));
+        }
+
+        BOOST_TEST(probe.use_count() == 6);
+
+        std::vector<Payload> out;
+        BOOST_TEST(ch.pop_batch(std::back_inserter(out), 2) == 2u);
+        BOOST_TEST(*out.front().value == 7);
+
+        Payload one(nullptr);
+        BOOST_TEST((asio_fiber::ChannelStatus::SUCCESS == ch.try_pop(one)));
+        BOOST_TEST(one.value == probe);
+
+        // the popped slots were destroyed in place, 2 + 1 popped and 2 still queued
+        BOOST_TEST(probe.use_count() == 6);
+    }
+
+    // the queued ones go with the channel
+    BOOST_TEST(probe.use_count() == 1);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,149 @@
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include "boost/asio/steady_timer.hpp"
+#include "boost/test/unit_test.hpp"
+
+#include "asio_fiber/object.h"
+#include "asio_fiber/yield.h"
+
+namespace
+{
+using Clock = std::chrono::steady_clock;
+using Timer = asio_fiber::Object<boost::asio::steady_timer>;
+
+// waits until n reaches expected, the test fails on the checks after it if that never happens
+void wait_for(const std::atomic<int>& n, int expected)
+{
+    auto deadline = Clock::now() + std::chrono::seconds(10);
+    while (n < expected && Clock::now() < deadline)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+}
+
+// the main fiber of a worker waits like an idle listener until stopped, idle counts it once it waits
+auto idle_worker(std::atomic<int>& idle)
+{
+    return [&idle](asio_fiber::ThreadContext&) {
+        Timer timer;
+        timer.expires_at((Clock::time_point::max)());
+        ++idle;
+        timer.async_wait(asio_fiber::yield());
+    };
+}
+
+struct Outcome
+{
+    // the timer is about to wait, the fiber suspends before the stop can reach its thread
+    std::atomic<int> armed{ 0 };
+    std::atomic<int> ended{ 0 };
+    std::atomic<int> ok{ 0 };
+
+    void end(bool success)
+    {
+        ok += success ? 1 : 0;
+        ++ended;
+    }
+};
+
+// a request whose timer runs for busy_for inside a busy section
+void spawn_busy(asio_fiber::ThreadGroup<>& group, Outcome& outcome, Clock::duration busy_for)
+{
+    group.post_one([&outcome, busy_for] {
+        asio_fiber::ThreadContext::current()->spawn([&outcome, busy_for] {
+            Timer timer;
+            auto busy = timer.busy();
+            timer.expires_after(busy_for);
+            ++outcome.armed;
+            outcome.end(timer.async_wait(asio_fiber::yield()).has_value());
+        }).detach();
+    });
+}
+
+// an idle keep-alive connection waiting outside any busy section
+void spawn_idle(asio_fiber::ThreadGroup<>& group, Outcome& outcome)
+{
+    group.post_one([&outcome] {
+        asio_fiber::ThreadContext::current()->spawn([&outcome] {
+            Timer timer;
+            timer.expires_after(std::chrono::hours(1));
+            ++outcome.armed;
+            outcome.end(timer.async_wait(asio_fiber::yield()).has_value());
+        }).detach();
+    });
+}
+}
+
+BOOST_AUTO_TEST_SUITE(drain)
+
+// busy sections finish, idle waits are cancelled at once, stop_all returns with the last busy one
+// long before the drain deadline. a busy timer cancelled by the stop would not end ok
+BOOST_AUTO_TEST_CASE(smooth_stop_lets_busy_sections_finish)
+{
+    Outcome busy, idle;
+    std::atomic<int> workers{ 0 };
+    asio_fiber::ThreadGroup<> group;
+    group.add_threads(2, idle_worker(workers));
+    wait_for(workers, 2);
+
+    for (int i = 0; i < 2; ++i)
+    {
+        spawn_busy(group, busy, std::chrono::milliseconds(150));
+        spawn_idle(group, idle);
+    }
+
+    wait_for(busy.armed, 2);
+    wait_for(idle.armed, 2);
+    auto start = Clock::now();
+    group.stop_all(asio_fiber::StopMode::SMOOTH, std::chrono::seconds(30));
+    auto took = Clock::now() - start;
+
+    BOOST_TEST(busy.ended == 2);
+    BOOST_TEST(busy.ok == 2);
+    BOOST_TEST(idle.ended == 2);
+    BOOST_TEST(idle.ok == 0);
+    BOOST_TEST((took < std::chrono::seconds(10)));
+}
+
+// a busy section past the drain deadline is forced
+BOOST_AUTO_TEST_CASE(smooth_stop_forces_past_the_deadline)
+{
+    Outcome stuck;
+    std::atomic<int> workers{ 0 };
+    asio_fiber::ThreadGroup<> group;
+    group.add_thread(idle_worker(workers));
+    wait_for(workers, 1);
+
+    spawn_busy(group, stuck, std::chrono::hours(1));
+    wait_for(stuck.armed, 1);
+
+    auto start = Clock::now();
+    group.stop_all(asio_fiber::StopMode::SMOOTH, std::chrono::milliseconds(100));
+    auto took = Clock::now() - start;
+
+    BOOST_TEST(stuck.ended == 1);
+    BOOST_TEST(stuck.ok == 0);
+    BOOST_TEST((took >= std::chrono::milliseconds(80)));
+    BOOST_TEST((took < std::chrono::seconds(10)));
+}
+
+BOOST_AUTO_TEST_CASE(force_stop_cancels_busy_sections)
+{
+    Outcome busy;
+    std::atomic<int> workers{ 0 };
+    asio_fiber::ThreadGroup<> group;
+    group.add_thread(idle_worker(workers));
+    wait_for(workers, 1);
+
+    spawn_busy(group, busy, std::chrono::hours(1));
+    wait_for(busy.armed, 1);
+
+    group.stop_all(asio_fiber::StopMode::FORCE);
+
+    BOOST_TEST(busy.ended == 1);
+    BOOST_TEST(busy.ok == 0);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
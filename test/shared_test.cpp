@@ -0,0 +1,78 @@
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include "boost/fiber/operations.hpp"
+#include "boost/test/unit_test.hpp"
+
+#include "asio_fiber/channel.h"
+#include "asio_fiber/thread.h"
+
+namespace
+{
+using Clock = std::chrono::steady_clock;
+}
+
+BOOST_AUTO_TEST_SUITE(shared)
+
+// the idle leader waits in the io_context for a pinned fiber woken from a plain thread, while
+// the other threads keep spending their poll budget. the wakeup must reach the leader every time
+BOOST_AUTO_TEST_CASE(busy_threads_leave_the_leader_wakeup)
+{
+    const int count = 1000;
+    asio_fiber::MpscChannel<int> ch(1024);
+    std::atomic<int> received{ 0 };
+    std::atomic<bool> busy_started{ false };
+    std::atomic<bool> done{ false };
+
+    asio_fiber::PollPolicy policy;
+    policy.budget = 2;
+
+    asio_fiber::ThreadGroup<> group(asio_fiber::Scheduling::SHARED);
+    group.set_poll_policy(policy);
+
+    // the main fiber of a thread is pinned, the first one idles as the leader in pop
+    group.add_thread([&](asio_fiber::ThreadContext&) {
+        int v = 0;
+        while (asio_fiber::ChannelStatus::SUCCESS == ch.pop(v))
+        {
+            ++received;
+        }
+    });
+
+    group.add_threads(3, [&](asio_fiber::ThreadContext&) {
+        busy_started = true;
+        while (!done)
+        {
+            boost::this_fiber::yield();
+        }
+    });
+
+    while (!busy_started)
+    {
+        std::this_thread::yield();
+    }
+
+    std::thread sender([&] {
+        for (int i = 0; i < count; ++i)
+        {
+            ch.try_push(i);
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
+    });
+    sender.join();
+
+    auto deadline = Clock::now() + std::chrono::seconds(10);
+    while (received < count && Clock::now() < deadline)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    BOOST_TEST(received.load() == count);
+
+    done = true;
+    ch.close();
+    group.stop_all();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
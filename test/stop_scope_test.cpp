@@ -0,0 +1,164 @@
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <vector>
+
+#include "boost/asio/ip/tcp.hpp"
+#include "boost/asio/post.hpp"
+#include "boost/asio/steady_timer.hpp"
+#include "boost/test/unit_test.hpp"
+
+#include "asio_fiber/object.h"
+#include "asio_fiber/yield.h"
+
+namespace
+{
+using Timer = asio_fiber::Object<boost::asio::steady_timer>;
+
+// never completes unless cancelled through its slot, so only a stop reaching the yield ends it
+template<typename Token>
+auto async_until_cancelled(boost::asio::io_context& ctx, Token&& token)
+{
+    return boost::asio::async_initiate<Token, void(boost::system::error_code)>([&ctx](auto handler) {
+        auto slot = boost::asio::get_associated_cancellation_slot(handler);
+        auto h = std::make_shared<decltype(handler)>(std::move(handler));
+        if (slot.is_connected())
+        {
+            slot.assign([&ctx, h](boost::asio::cancellation_type) {
+                boost::asio::post(ctx, [h] { (*h)(boost::asio::error::operation_aborted); });
+            });
+        }
+    }, token);
+}
+
+// true if the timer was cancelled rather than expired
+bool wait_long(Timer& timer)
+{
+    timer.expires_after(std::chrono::hours(1));
+    return !timer.async_wait(asio_fiber::yield()).has_value();
+}
+
+void settle()
+{
+    boost::this_fiber::sleep_for(std::chrono::milliseconds(10));
+}
+}
+
+BOOST_AUTO_TEST_SUITE(stop_scope)
+
+// listener > connections > request: stopping one connection leaves its siblings and the listener
+// alone, stopping the listener reaches every level, spawned fibers included
+BOOST_AUTO_TEST_CASE(stop_reaches_nested_scopes_and_spawned_fibers)
+{
+    std::atomic<int> connections_cancelled{ 0 };
+    std::atomic<int> requests_cancelled{ 0 };
+    bool sibling_alive_after_one_stop = false;
+    bool listener_cancelled = false;
+
+    asio_fiber::Thread<> thread([&](asio_fiber::ThreadContext& ctx) {
+        asio_fiber::StopScope listener;
+        auto listener_handle = listener.get_handle();
+        std::vector<asio_fiber::StopHandle> connections;
+
+        for (int i = 0; i < 3; ++i)
+        {
+            ctx.spawn([&] {
+                asio_fiber::StopScope connection;
+                connections.push_back(connection.get_handle());
+
+                auto request = ctx.spawn([&] {
+                    asio_fiber::StopScope scope;
+                    auto r = async_until_cancelled(ctx, asio_fiber::yield());
+                    requests_cancelled += r.has_value() ? 0 : 1;
+                });
+
+                Timer timer;
+                connections_cancelled += wait_long(timer) ? 1 : 0;
+                request.join();
+            }).detach();
+        }
+
+        boost::fibers::fiber stopper([&] {
+            settle();
+            connections[1].stop();
+            settle();
+            sibling_alive_after_one_stop = 1 == connections_cancelled && 1 == requests_cancelled;
+            listener_handle.stop();
+        });
+
+        Timer timer;
+        listener_cancelled = wait_long(timer);
+        stopper.join();
+
+        while (connections_cancelled < 3 || requests_cancelled < 3)
+        {
+            settle();
+        }
+    });
+    thread.join();
+
+    BOOST_TEST(sibling_alive_after_one_stop);
+    BOOST_TEST(listener_cancelled);
+    BOOST_TEST(connections_cancelled == 3);
+    BOOST_TEST(requests_cancelled == 3);
+}
+
+// nothing new runs in a cancelled scope, neither a nested scope nor an object nor a yield
+BOOST_AUTO_TEST_CASE(new_work_in_a_stopped_scope_ends_at_once)
+{
+    bool nested_stopping = false;
+    bool object_closed = false;
+    bool yield_cancelled = false;
+
+    asio_fiber::Thread<> thread([&](asio_fiber::ThreadContext& ctx) {
+        asio_fiber::StopScope scope;
+        scope.get_handle().stop();
+
+        asio_fiber::StopScope nested;
+        nested_stopping = nested.get_handle().stopping();
+
+        asio_fiber::Object<boost::asio::ip::tcp::acceptor> acceptor(boost::asio::ip::tcp::v4());
+        object_closed = !acceptor.is_open();
+        yield_cancelled = !async_until_cancelled(ctx, asio_fiber::yield()).has_value();
+    });
+    thread.join();
+
+    BOOST_TEST(nested_stopping);
+    BOOST_TEST(object_closed);
+    BOOST_TEST(yield_cancelled);
+}
+
+// a smooth stop of a scope closes idle objects and leaves busy ones until their section ends
+BOOST_AUTO_TEST_CASE(smooth_stop_waits_for_busy_objects)
+{
+    bool idle_cancelled = false;
+    bool busy_expired = false;
+
+    asio_fiber::Thread<> thread([&](asio_fiber::ThreadContext& ctx) {
+        asio_fiber::StopScope scope;
+        auto handle = scope.get_handle();
+
+        auto idle = ctx.spawn([&] {
+            Timer timer;
+            idle_cancelled = wait_long(timer);
+        });
+
+        auto busy = ctx.spawn([&] {
+            Timer timer;
+            auto section = timer.busy();
+            timer.expires_after(std::chrono::milliseconds(50));
+            busy_expired = timer.async_wait(asio_fiber::yield()).has_value();
+        });
+
+        settle();
+        handle.stop(asio_fiber::StopMode::SMOOTH);
+        idle.join();
+        busy.join();
+    });
+    thread.join();
+
+    BOOST_TEST(idle_cancelled);
+    BOOST_TEST(busy_expired);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
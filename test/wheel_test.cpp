@@ -0,0 +1,116 @@
+#include <chrono>
+#include <vector>
+
+#include "boost/test/unit_test.hpp"
+
+#include "asio_fiber/wheel.h"
+
+namespace
+{
+using Clock = asio_fiber::TimerWheel::Clock;
+
+struct Fired
+{
+    asio_fiber::TimerWheel* wheel;
+    Clock::time_point at;
+    int count = 0;
+
+    static void on_fire(void* arg)
+    {
+        auto self = static_cast<Fired*>(arg);
+        self->at = self->wheel->now();
+        ++self->count;
+    }
+};
+}
+
+BOOST_AUTO_TEST_SUITE(wheel)
+
+// one tick at a time through every level, each timer fires once on the tick it is due
+BOOST_AUTO_TEST_CASE(fires_when_due_on_every_level)
+{
+    const auto tick = std::chrono::milliseconds(1);
+    const auto start = Clock::now();
+    asio_fiber::TimerWheel wheel(tick, start);
+
+    const std::vector<int> delays{ 0, 1, 5, 63, 64, 65, 4095, 4096, 4097, 5000, 262143, 262144, 300000 };
+    std::vector<asio_fiber::WheelTimer> timers(delays.size());
+    std::vector<Fired> fired(delays.size(), Fired{ &wheel });
+
+    for (size_t i = 0; i < delays.size(); ++i)
+    {
+        wheel.arm(timers[i], start + std::chrono::milliseconds(delays[i]), &Fired::on_fire, &fired[i]);
+    }
+
+    for (int t = 0; t <= delays.back(); ++t)
+    {
+        wheel.update(start + std::chrono::milliseconds(t));
+    }
+
+    BOOST_TEST(wheel.empty());
+    for (size_t i = 0; i < delays.size(); ++i)
+    {
+        BOOST_TEST_CONTEXT("delay " << delays[i])
+        {
+            BOOST_TEST(fired[i].count == 1);
+            BOOST_TEST(!timers[i].armed());
+            BOOST_TEST((fired[i].at == start + std::chrono::milliseconds(delays[i])));
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(coarse_update_fires_late_never_early)
+{
+    const auto start = Clock::now();
+    asio_fiber::TimerWheel wheel(std::chrono::milliseconds(1), start);
+
+    asio_fiber::WheelTimer timer;
+    Fired fired{ &wheel };
+    wheel.arm(timer, start + std::chrono::microseconds(2500), &Fired::on_fire, &fired);
+
+    wheel.update(start + std::chrono::milliseconds(2));
+    BOOST_TEST(fired.count == 0);
+
+    wheel.update(start + std::chrono::milliseconds(10));
+    BOOST_TEST(fired.count == 1);
+}
+
+BOOST_AUTO_TEST_CASE(cancel_before_expiry)
+{
+    const auto start = Clock::now();
+    asio_fiber::TimerWheel wheel(std::chrono::milliseconds(1), start);
+
+    asio_fiber::WheelTimer kept, cancelled;
+    Fired kept_fired{ &wheel }, cancelled_fired{ &wheel };
+    wheel.arm(kept, start + std::chrono::milliseconds(100), &Fired::on_fire, &kept_fired);
+    wheel.arm(cancelled, start + std::chrono::milliseconds(100), &Fired::on_fire, &cancelled_fired);
+
+    cancelled.cancel();
+    BOOST_TEST(!cancelled.armed());
+
+    wheel.update(start + std::chrono::milliseconds(200));
+    BOOST_TEST(kept_fired.count == 1);
+    BOOST_TEST(cancelled_fired.count == 0);
+    BOOST_TEST(wheel.empty());
+}
+
+BOOST_AUTO_TEST_CASE(next_expiry_tracks_the_earliest_timer)
+{
+    const auto start = Clock::now();
+    asio_fiber::TimerWheel wheel(std::chrono::milliseconds(1), start);
+    BOOST_TEST((wheel.next_expiry() == (Clock::time_point::max)()));
+
+    asio_fiber::WheelTimer near, far;
+    Fired near_fired{ &wheel }, far_fired{ &wheel };
+    wheel.arm(far, start + std::chrono::milliseconds(50), &Fired::on_fire, &far_fired);
+    wheel.arm(near, start + std::chrono::milliseconds(3), &Fired::on_fire, &near_fired);
+
+    // a coarser level may report its cascade first, never a time past the earliest expiry
+    BOOST_TEST((wheel.next_expiry() <= start + std::chrono::milliseconds(3)));
+
+    wheel.update(start + std::chrono::milliseconds(3));
+    BOOST_TEST(near_fired.count == 1);
+    BOOST_TEST((wheel.next_expiry() <= start + std::chrono::milliseconds(50)));
+}
+
+BOOST_AUTO_TEST_SUITE_END()